@@ -144,6 +144,105 @@ classdef ollama < handle
     ## @end deftp
     writeTimeout = 300;
 
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} compression
+    ##
+    ## HTTP compression policy.
+    ##
+    ## A character vector specifying whether the traffic with the server is
+    ## compressed.  With @qcode{'response'}, compressed responses are accepted,
+    ## which mostly benefits large embedding responses.  With @qcode{'all'},
+    ## large requests, such as chat histories with images, are also sent gzip
+    ## compressed.  @qcode{'none'} disables compression.  The ollama server
+    ## itself does not compress its responses and does not accept compressed
+    ## requests, so this only has an effect when the server is behind a reverse
+    ## proxy that supports compression.  By default, @qcode{compression} is
+    ## @qcode{'response'}.
+    ##
+    ## @end deftp
+    compression = 'response';
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} healthCheck
+    ##
+    ## Server health check policy.
+    ##
+    ## A nonnegative scalar specifying the time in seconds for which the status
+    ## of the ollama server is cached before it is probed again by the next
+    ## request.  Set it to 0 to probe the server before every request.
+    ## Alternatively, set it to @qcode{'lazy'} to probe the server only after a
+    ## request has failed.  By default, @qcode{healthCheck} is 5 seconds.
+    ##
+    ## @end deftp
+    healthCheck = 5;
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} serverPool
+    ##
+    ## Pool of interchangeable ollama servers.
+    ##
+    ## A cell array of character vectors with the URLs of several ollama
+    ## servers, among which the inference requests of @code{query}, @code{chat},
+    ## and @code{embed} are distributed.  Each request is sent to the server with
+    ## the fewest requests in flight, preferring servers that already have the
+    ## active model loaded, and it is sent again to another server if the
+    ## selected one cannot be reached.  Batched prompts and chunked embeddings
+    ## are spread over all servers of the pool.  Model management and listing
+    ## still use @qcode{serverURL}.  By default, @qcode{serverPool} is empty
+    ## and all requests are sent to @qcode{serverURL}.
+    ##
+    ## @end deftp
+    serverPool = {};
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} embeddingCache
+    ##
+    ## Embedding cache file.
+    ##
+    ## A character vector with the filename of a cache for the vectors
+    ## generated by the @code{embed} method.  When set, only the inputs whose
+    ## embeddings are not already cached for the same model and dimensions are
+    ## sent to the ollama server, and their newly generated embeddings are
+    ## appended to the cache.  The cache file is created if it does not exist
+    ## and it stores the embedding vectors in single precision, so that all
+    ## vectors returned through the cache have single precision accuracy.  By
+    ## default, @qcode{embeddingCache} is empty and no cache is used.
+    ##
+    ## @end deftp
+    embeddingCache = '';
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} responseCache
+    ##
+    ## Response cache size.
+    ##
+    ## A nonnegative integer scalar specifying the maximum number of responses
+    ## to @code{query} and @code{chat} requests, which are kept in memory so
+    ## that an identical request (same model, prompt or messages, options,
+    ## system message, and thinking mode) is answered without contacting the
+    ## ollama server.  This is only meaningful for deterministic requests, such
+    ## as those with a fixed @qcode{seed} and zero @qcode{temperature} options.
+    ## By default, @qcode{responseCache} is 0, which disables the memory cache.
+    ## The number of cache hits and misses is displayed by @code{showStats}.
+    ##
+    ## @end deftp
+    responseCache = 0;
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} responseCacheDir
+    ##
+    ## Response cache directory.
+    ##
+    ## A character vector with the name of a directory, in which responses to
+    ## @code{query} and @code{chat} requests are stored as files, so that
+    ## identical requests are answered without contacting the ollama server
+    ## across different sessions.  The directory is created if it does not
+    ## exist.  By default, @qcode{responseCacheDir} is empty and responses are
+    ## not stored on disk.
+    ##
+    ## @end deftp
+    responseCacheDir = '';
+
     ## -*- texinfo -*-
     ## @deftp {ollama} {property} options
     ##
@@ -229,6 +328,109 @@ classdef ollama < handle
     ##
     ## @end deftp
     muteThinking = false;
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} streamFunction
+    ##
+    ## Callback function for streaming responses.
+    ##
+    ## A function handle, which is called with each token of the model's
+    ## response as a character vector, while the response is being streamed
+    ## from the ollama server during @code{query} and @code{chat} requests.
+    ## This allows displaying or processing the response text as soon as it is
+    ## generated instead of waiting for the entire response.  When specified,
+    ## @code{query} and @code{chat} do not display the response text when
+    ## called without output arguments, since this is handled by the callback
+    ## function, as in @code{@var{llm}.streamFunction = @@(txt) fprintf (txt)}.
+    ## The complete response is still returned by @code{query} and @code{chat}
+    ## and it is also stored in the chat history.  If the callback function
+    ## returns @qcode{false}, then the request is canceled.  By default,
+    ## @qcode{streamFunction} is empty and responses are not streamed.
+    ##
+    ## @end deftp
+    streamFunction = [];
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} keepContext
+    ##
+    ## Flag for continuing queries from the previous context.
+    ##
+    ## A logical scalar specifying whether each @code{query} request continues
+    ## from the context of the previous @code{query} request.  When enabled,
+    ## the context tokens returned by the ollama server are kept internally
+    ## and passed to the next @code{query} request, so that the model is aware
+    ## of the previous prompts and responses without having to evaluate them
+    ## again.  The context is discarded when @qcode{keepContext} is modified,
+    ## when a new model is loaded, or when the chat history is cleared with the
+    ## @code{clearHistory} method.  It is not used by @code{queryAsync} and
+    ## @code{queryBatch}.  By default, @qcode{keepContext} is @qcode{false}.
+    ##
+    ## @end deftp
+    keepContext = false;
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} imageMaxSize
+    ##
+    ## Maximum image size for vision models.
+    ##
+    ## A nonnegative integer scalar specifying the maximum edge in pixels of the
+    ## images passed to @code{query} and @code{chat} requests.  PNG images that
+    ## are larger, either as files or as base64 encoded strings, are downscaled
+    ## before they are sent to the ollama server, keeping their aspect ratio.
+    ## Vision models resize their inputs internally anyway, so a limit matching
+    ## the model's input resolution reduces the upload size and the decoding
+    ## time of the server.  Only PNG images written by the fpng encoder, such
+    ## as those returned by @code{fig2base64}, can be downscaled; any other
+    ## images are sent unchanged.  By default, @qcode{imageMaxSize} is 0, which
+    ## sends all images unchanged.
+    ##
+    ## @end deftp
+    imageMaxSize = 0;
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} keepAlive
+    ##
+    ## Model keep alive duration.
+    ##
+    ## The time that the ollama server keeps the active model loaded in memory
+    ## after each request, either as a character vector with a duration such as
+    ## @qcode{'10m'} or @qcode{'1h30m'}, or as a real scalar in seconds.  A
+    ## negative value keeps the model loaded indefinitely, while 0 unloads the
+    ## model right after each request.  By default, @qcode{keepAlive} is
+    ## @qcode{'5m'}.
+    ##
+    ## @end deftp
+    keepAlive = '5m';
+
+    ## -*- texinfo -*-
+    ## @deftp {ollama} {property} keepWarm
+    ##
+    ## Flag for keeping the active model warm.
+    ##
+    ## A logical scalar specifying whether the active model is loaded again by
+    ## a background thread before its @qcode{keepAlive} duration expires, so
+    ## that requests after an idle period do not wait for the model to be
+    ## loaded.  The background thread is stopped when the active model changes
+    ## or is unloaded, and when the ollama interface object is deleted.  By
+    ## default, @qcode{keepWarm} is @qcode{false}.
+    ##
+    ## @end deftp
+    keepWarm = false;
+  endproperties
+
+  properties (Access = private, Hidden)
+    ## Pending asynchronous requests
+    pendingRequests = struct ('id', {}, 'type', {}, 'message', {});
+    ## Native session handle for marshalling the chat history incrementally
+    sessionID = 0;
+    ## Request settings last stored in the native session
+    sessionSettings = {};
+    ## Whether the statistics of the last response are still in the session
+    responsePending = false;
+    ## JSON encoded tools, updated whenever the tools are assigned
+    toolsJSON = "NA";
+    ## Client-side timing of the last query or chat request
+    clientTiming = struct ();
   endproperties
 
   methods (GetAccess = public)
@@ -507,9 +709,11 @@ classdef ollama < handle
                                                   'serverURL', this.serverURL);
       endif
       if (strcmp (model, this.activeModel))
+        set_keep_warm (this, false);
         this.activeModel = '';
         this.thinking = [];
         this.tools = [];
+        this.toolsJSON = "NA";
       endif
     endfunction
 
@@ -553,22 +757,29 @@ classdef ollama < handle
         error (strcat ("ollama.loadModel: MODEL must be a character", ...
                        " vector or an index to 'availableModels'."));
       endif
+      set_keep_warm (this, false);
       this.activeModel = model;
+      ## Context and chat session of the previous model are not valid
+      close_session (this);
       if (checkEmbedding (this))
         [out, err] = __ollama__ ('loadModel', model, ...
                                  'embeddingModel', true, ...
-                                 'serverURL', this.serverURL);
+                                 'serverURL', this.serverURL, ...
+                                 'keepAlive', this.keepAlive);
         this.mode = 'embed';
       else
         [out, err] = __ollama__ ('loadModel', model, ...
-                                 'serverURL', this.serverURL);
+                                 'serverURL', this.serverURL, ...
+                                 'keepAlive', this.keepAlive);
       endif
       if (err)
         this.activeModel = '';
         this.thinking = [];
         this.tools = [];
+        this.toolsJSON = "NA";
         error ("ollama.loadModel: MODEL could not be loaded.");
       endif
+      set_keep_warm (this, this.keepWarm);
       ## Query active model for information and set default thinking
       ## to true if model is capable of thinking, unless mode == 'embed'
       if (! strcmp (this.mode, 'embed'))
@@ -616,14 +827,17 @@ classdef ollama < handle
       if (err)
         error ("ollama.unloadModel: MODEL not found.");
       elseif (strcmp (this.activeModel, model))
+        set_keep_warm (this, false);
         this.activeModel = '';
         this.thinking = [];
         this.tools = [];
+        this.toolsJSON = "NA";
       endif
     endfunction
 
     ## -*- texinfo -*-
-    ## @deftypefn {ollama} {} pullModel (@var{llm}, @var{target})
+    ## @deftypefn  {ollama} {} pullModel (@var{llm}, @var{target})
+    ## @deftypefnx {ollama} {} pullModel (@var{llm}, @var{target}, @var{progress})
     ##
     ## Download model from the ollama library into ollama server.
     ##
@@ -631,19 +845,48 @@ classdef ollama < handle
     ## by @var{target} from the ollama library into the ollama server interfaced
     ## by @var{llm}.  If successful, the model is appended to list of available
     ## models in the @qcode{@var{llm}.availableModels} property.  @var{target}
-    ## must be a character vector.
+    ## must be a character vector.  The download status is streamed from the
+    ## server, so that the @qcode{readTimeout} only limits the time between
+    ## consecutive status updates.  If the connection to the server is lost,
+    ## the download resumes from the partially downloaded layers kept by the
+    ## server.
+    ##
+    ## @code{pullModel (@var{llm}, @var{target}, @var{progress})} also reports
+    ## the progress of the download.  If @var{progress} is @qcode{true}, the
+    ## status and the percentage of the layer being downloaded are printed in
+    ## the command window.  If @var{progress} is a function handle, it is called
+    ## with each status update as a structure with @qcode{status},
+    ## @qcode{digest}, @qcode{total}, and @qcode{completed} fields, where the
+    ## last two are the total and the downloaded bytes of the layer with the
+    ## given digest.  The download is canceled if the function returns
+    ## @qcode{false}.  Pressing @kbd{Ctrl-C} also cancels the download.
     ##
     ## @end deftypefn
-    function pullModel (this, model)
+    function pullModel (this, model, progress = false)
       if (! ischar (model))
         error ("ollama.pullModel: MODEL must be a character vector.");
       endif
-      [out, err] = __ollama__ ('pullModel', model, 'serverURL', this.serverURL);
+      args = {'pullModel', model, 'serverURL', this.serverURL};
+      print_progress = false;
+      if (is_function_handle (progress))
+        args = [args, {'stream', progress}];
+      elseif (isscalar (progress) && (islogical (progress) || isnumeric (progress)))
+        if (progress)
+          print_progress = true;
+          args = [args, {'stream', @print_pull_progress}];
+        endif
+      else
+        error (strcat ("ollama.pullModel: PROGRESS must be either a", ...
+                       " logical scalar or a function handle."));
+      endif
+      [out, err] = __ollama__ (args{:});
+      if (print_progress)
+        fprintf ("\n");
+      endif
       if (err)
-        msg = strcat ("If you get a time out error, try to increase the", ...
-                      " 'readTimeout' and 'writeTimeout' parameters\n", ...
-                      "   to allow more time for ollama server to download", ...
-                      " the requested model.");
+        msg = strcat ("If the connection was lost, try to pull the model", ...
+                      " again to resume\n   the download from the", ...
+                      " partially downloaded layers.");
         error ("ollama.pullModel: %s\n   %s", out, msg);
       else
         [this.availableModels, err] = __ollama__ ('listModels', 'cellstr', ...
@@ -1041,75 +1284,26 @@ classdef ollama < handle
       elseif (nargin < 2)
         error ("ollama.query: too few input arguments.");
       endif
-      ## Validate user prompt
-      if (nargin > 1)
-        prompt = varargin{1};
-        if (! (isvector (prompt) && ischar (prompt)))
-          error ("ollama.query: PROMPT must be a character vector.");
-        endif
-        args = {'prompt', prompt};
-      endif
-      ## Validate any images
-      if (nargin > 2)
-        image = varargin{2};
-        if (! ischar (image) && ! iscellstr (image) && ! isvector (image))
-          error (strcat ("ollama.query: IMAGE must be either a character", ...
-                         " vector or a cell array of character vectors."));
-        endif
-        ## Check for either imageFile or imageBase64 strings
-        if (ischar (image))
-          if (any ('.' == image))
-            type = 'imageFile';
-          else
-            type = 'imageBase64';
-          endif
-        else  # cellstr
-          fcn = @(x) any ('.' == x);
-          TF = cellfun (fcn, image);
-          if (all (TF))
-            type = 'imageFile';
-          elseif (! any (TF))
-            type = 'imageBase64';
-          else
-            error (strcat ("ollama.query: IMAGE must either contain", ...
-                           " file names or base64_encoded strings."));
-          endif
-        endif
-        args = [args, {type, image}];
-      endif
-      ## Get thinking status
-      if (islogical (this.thinking))
-        if (this.thinking)
-          think = 'true';
-        else
-          think = 'false';
-        endif
-      else
-        think = this.thinking;
+      args = query_args (this, 'query', varargin{:});
+      ## Stream response (if requested)
+      if (! isempty (this.streamFunction))
+        args = [args, {'stream', this.streamFunction}];
       endif
       ## Run inference
-      [out, err] = __ollama__ ('model', this.activeModel, ...
-                               'serverURL', this.serverURL, ...
-                               'readTimeout', this.readTimeout, ...
-                               'writeTimeout', this.writeTimeout, ...
-                               'options', this.options, ...
-                               'systemMessage', this.systemMessage, ...
-                               'think', think, args{:});
+      [out, err, ~, timing] = __ollama__ (args{:}, 'lazyResponse', true);
       if (err)
         error ("ollama.query: %s", out);
       endif
-      ## Decode json output
-      this.responseStats = jsondecode (out);
-      ## Get output
-      if (this.thinking)
-        out = {strtrim(this.responseStats.response); ...
-               strtrim(this.responseStats.thinking)};
-      else
-        out = strtrim (this.responseStats.response);
-      endif
+      t = tic ();
+      out = query_output (this, out);
+      timing.decode = toc (t);
+      this.clientTiming = timing;
       ## Return response text
       if (nargout > 0)
         varargout{1} = out;
+      elseif (! isempty (this.streamFunction))
+        ## Response has already been handled by the callback function
+        return;
       else
         if (this.thinking)
           if (this.muteThinking)
@@ -1128,6 +1322,83 @@ classdef ollama < handle
       endif
     endfunction
 
+    ## -*- texinfo -*-
+    ## @deftypefn  {ollama} {@var{txt} =} queryBatch (@var{llm}, @var{prompts})
+    ## @deftypefnx {ollama} {@var{txt} =} queryBatch (@var{llm}, @var{prompts}, @var{concurrency})
+    ## @deftypefnx {ollama} {[@var{txt}, @var{errmsg}] =} queryBatch (@dots{})
+    ##
+    ## Query a model in ollama server with multiple prompts in parallel.
+    ##
+    ## @code{@var{txt} = queryBatch (@var{llm}, @var{prompts})} sends each
+    ## prompt in the cell array of character vectors @var{prompts} as an
+    ## independent request to the @qcode{"api/generate"} API end point, in the
+    ## same way as the @code{query} method does, and returns the responses in
+    ## a cell array @var{txt} of the same size as @var{prompts}.  The requests
+    ## are sent over a pool of persistent connections on background threads,
+    ## so that the ollama server can process them simultaneously according to
+    ## its @qcode{OLLAMA_NUM_PARALLEL} setting.  If thinking is enabled, each
+    ## element of @var{txt} is a @math{2x1} cell array with the response and
+    ## the thinking text.
+    ##
+    ## @code{@var{txt} = queryBatch (@var{llm}, @var{prompts},
+    ## @var{concurrency})} also specifies the number of simultaneous
+    ## connections to the ollama server as a positive integer scalar.  By
+    ## default, @var{concurrency} is 4.
+    ##
+    ## @code{[@var{txt}, @var{errmsg}] = queryBatch (@dots{})} also returns a
+    ## cell array of character vectors @var{errmsg} of the same size as
+    ## @var{prompts}, which contains the error message of each failed request
+    ## or an empty character vector for each successful request.  The
+    ## corresponding elements of @var{txt} are empty.  If @var{errmsg} is not
+    ## requested, any failed request raises an error.
+    ##
+    ## The @qcode{responseStats} property is updated with the response
+    ## statistics of the last successful request in the batch.
+    ##
+    ## @seealso{query, queryAsync}
+    ## @end deftypefn
+    function [txt, errmsg] = queryBatch (this, prompts, concurrency = 4)
+      ## Check active model exists
+      if (isempty (this.activeModel))
+        error ("ollama.queryBatch: no model has been loaded yet.");
+      endif
+      if (nargin < 2)
+        error ("ollama.queryBatch: too few input arguments.");
+      endif
+      if (ischar (prompts) && isvector (prompts))
+        prompts = cellstr (prompts);
+      endif
+      if (! iscellstr (prompts) || isempty (prompts))
+        error (strcat ("ollama.queryBatch: PROMPTS must be a non-empty", ...
+                       " cell array of character vectors."));
+      endif
+      if (! (isscalar (concurrency) && isnumeric (concurrency) && ...
+             fix (concurrency) == concurrency && concurrency >= 1))
+        error ("ollama.queryBatch: CONCURRENCY must be a positive integer.");
+      endif
+      args = query_args (this, 'queryBatch', prompts{1});
+      args(end-1:end) = {'promptBatch', prompts};
+      ## Run inference
+      [out, err] = __ollama__ (args{:}, 'concurrency', concurrency);
+      if (! iscell (out))
+        error ("ollama.queryBatch: server is inaccessible at %s.", ...
+               this.serverURL);
+      endif
+      txt = cell (size (prompts));
+      errmsg = repmat ({''}, size (prompts));
+      for i = 1:numel (prompts)
+        if (err(i))
+          errmsg{i} = out{i};
+        else
+          txt{i} = query_output (this, out{i});
+        endif
+      endfor
+      if (nargout < 2 && any (err))
+        idx = find (err, 1);
+        error ("ollama.queryBatch: request %d failed: %s", idx, errmsg{idx});
+      endif
+    endfunction
+
     ## -*- texinfo -*-
     ## @deftypefn  {ollama} {} chat (@var{llm}, @var{prompt})
     ## @deftypefnx {ollama} {} chat (@var{llm}, @var{prompt}, @var{image})
@@ -1225,111 +1496,26 @@ classdef ollama < handle
       elseif (nargin < 2)
         error ("ollama.chat: too few input arguments.");
       endif
-      ## Initialize new chat or use previous history
-      message = {'', {'', ''}, {''; ''; ''}};
-      if (! isempty (this.chatHistory))
-        message = [this.chatHistory; message];
-      endif
-      ## Validate first input either as "role:user" or as "role:tool"
-      if (nargin > 1)
-        prompt = varargin{1};
-        if (isempty (this.tools))
-          if (isvector (prompt) && ischar (prompt))
-            message(end, 1) = prompt;
-          else
-            error ("ollama.chat: PROMPT must be a character vector.");
-          endif
-        else
-          if (isvector (prompt) && ischar (prompt))
-            message(end, 1) = prompt;
-          elseif (columns (prompt) == 2 && iscellstr (prompt))
-            message(end, 1) = prompt;
-          else
-            error ("ollama.chat: first input argument must be either", ...
-                   " a character vector or a two-column cell array", ...
-                   " of character vectors.");
-          endif
-        endif
-      endif
-      ## Validate any images
-      if (nargin > 2)
-        image = varargin{2};
-        if (! ischar (image) && ! iscellstr (image) && ! isvector (image))
-          error (strcat ("ollama.chat: IMAGE must be either a character", ...
-                         " vector or a cell array of character vectors."));
-        endif
-        ## Check for either imageFile or imageBase64 strings
-        if (ischar (image))
-          if (any ('.' == image))
-            message{end, 2}(1) = 'imageFile';
-          else
-            message{end, 2}(1) = 'imageBase64';
-          endif
-          message{end, 2}(2) = image;
-        else  # cellstr
-          fcn = @(x) any ('.' == x);
-          TF = cellfun (fcn, image);
-          for img = 1:numel (TF)
-            if (TF(img))
-              message{end, 2}(img, 1) = 'imageFile';
-            else
-              message{end, 2}(img, 1) = 'imageBase64';
-            endif
-            message{end, 2}(img, 2) = image{img};
-          endfor
-        endif
-      endif
-      ## Get thinking status
-      if (islogical (this.thinking))
-        if (this.thinking)
-          think = 'true';
-        else
-          think = 'false';
-        endif
-      else
-        think = this.thinking;
-      endif
-      ## Handle tools
-      if (isempty (this.tools))
-        tools = "NA";
-      elseif (isa (this.tools, 'toolFunction'))
-        tools = jsonencode ({encodeFunction(this.tool)});
-      else # it must be a toolRegistry
-        tools = jsonencode (encodeRegistry(this.tool));
+      [args, message] = chat_args (this, 'chat', varargin{:});
+      ## Stream response (if requested)
+      if (! isempty (this.streamFunction))
+        args = [args, {'stream', this.streamFunction}];
       endif
       ## Run inference
-      [out, err] = __ollama__ ('model', this.activeModel, ...
-                               'serverURL', this.serverURL, ...
-                               'readTimeout', this.readTimeout, ...
-                               'writeTimeout', this.writeTimeout, ...
-                               'options', this.options, ...
-                               'message', message, ...
-                               'systemMessage', this.systemMessage, ...
-                               'think', think, 'tools', tools);
+      [out, err, ~, timing] = __ollama__ (args{:}, 'lazyResponse', true);
       if (err)
         error ("ollama.chat: %s", out);
       endif
-      ## Decode json output
-      this.responseStats = jsondecode (out, 'makeValidName', false);
-      ## Grab tool_calls (if any)
-      tool_calls = '';
-      if (! isempty (this.tools))
-        if (ismember (fieldnames (this.responseStats.message), 'tool_calls'))
-          tool_calls = this.responseStats.message.tool_calls;
-        endif
-      endif
-      ## Add response to chat history
-      if (this.thinking || ! isempty (tool_calls))
-        message{end,3}(1) = strtrim (this.responseStats.message.content);
-        message{end,3}(2) = strtrim (this.responseStats.message.thinking);
-        message{end,3}(3) = jsonencode (tool_calls);
-      else
-        message(end,3) = strtrim (this.responseStats.message.content);
-      endif
-      this.chatHistory = message;
+      t = tic ();
+      [message, tool_calls] = chat_output (this, out, message);
+      timing.decode = toc (t);
+      this.clientTiming = timing;
       ## Return response text
       if (nargout > 0)
         varargout{1} = message{end,3};
+      elseif (! isempty (this.streamFunction))
+        ## Response has already been handled by the callback function
+        return;
       else
         if (this.thinking)
           if (this.muteThinking)
@@ -1363,6 +1549,7 @@ classdef ollama < handle
     ## -*- texinfo -*-
     ## @deftypefn  {ollama} {@var{vectors} =} embed (@var{llm}, @var{input})
     ## @deftypefnx {ollama} {@var{vectors} =} embed (@var{llm}, @var{input}, @var{dims})
+    ## @deftypefnx {ollama} {@var{vectors} =} embed (@dots{}, @var{Name}, @var{Value})
     ##
     ## Generate embeddings.
     ##
@@ -1380,8 +1567,36 @@ classdef ollama < handle
     ## be a positive integer value, which overrides the default settings of the
     ## embedding model.
     ##
+    ## @code{@var{vectors} = embed (@dots{}, @var{Name}, @var{Value})} also
+    ## specifies additional parameters as @var{Name}, @var{Value} paired
+    ## arguments.  Use @qcode{[]} for @var{dims} to keep the model's default
+    ## length.  The following parameters are supported:
+    ##
+    ## @itemize
+    ## @item @qcode{'precision'} A character vector specifying whether
+    ## @var{vectors} is returned as a @qcode{'double'} (default) or a
+    ## @qcode{'single'} precision matrix.
+    ## @item @qcode{'chunkSize'} A nonnegative integer scalar specifying the
+    ## maximum number of inputs sent to the server with a single request.
+    ## Larger @var{input} is split into chunks, which are sent concurrently and
+    ## whose embedding vectors are returned in @var{vectors} in input order.
+    ## By default, @qcode{'chunkSize'} is 0, which disables this limit.
+    ## @item @qcode{'chunkChars'} A nonnegative integer scalar specifying the
+    ## maximum total number of characters sent to the server with a single
+    ## request.  By default, @qcode{'chunkChars'} is 0, which disables this
+    ## limit.
+    ## @item @qcode{'concurrency'} A positive integer scalar specifying the
+    ## number of chunks sent simultaneously over separate connections.  By
+    ## default, @qcode{'concurrency'} is 1.
+    ## @item @qcode{'retries'} A nonnegative integer scalar specifying how many
+    ## times a failed chunk is sent again.  If any chunk still fails, its rows
+    ## in @var{vectors} are set to @qcode{NaN} and a warning is issued.  The
+    ## indices of the failed inputs are listed in the @qcode{failed} field of
+    ## the @qcode{responseStats} property.  By default, @qcode{'retries'} is 2.
+    ## @end itemize
+    ##
     ## @end deftypefn
-    function vectors = embed (this, input, dims = 0)
+    function vectors = embed (this, input, dims = 0, varargin)
       ## Check active model exists and has embeding capabilities
       if (isempty (this.activeModel))
         error ("ollama.embed: no model has been loaded yet.");
@@ -1389,35 +1604,201 @@ classdef ollama < handle
       if (! strcmp (this.mode, 'embed'))
         error ("ollama.embed: active model has no embedding capabilities.");
       endif
-      ## Check input
-      if (isempty (input))
-        error ("ollama.embed: INPUT cannot be empty.");
+      args = embed_args (this, 'embed', input, dims, varargin{:});
+      ## Run inference
+      [out, err, stats] = __ollama__ (args{:});
+      if (err)
+        error ("ollama.embed: %s", out);
       endif
-      if (ischar (input) && isvector (input) || isa (input, 'string'))
-        input = cellstr (input);
+      vectors = embed_output (this, out, stats);
+      if (isfield (stats, 'failed') && ! isempty (stats.failed))
+        warning ("ollama.embed: failed to embed %d of %d inputs.", ...
+                 numel (stats.failed), rows (vectors));
       endif
-      if (! iscellstr (input) || any (cellfun ('isempty', input)))
-        error (strcat ("ollama.embed: INPUT must be a non-empty character", ...
-                       " vector or a cell array of non-empty character vectors."));
+    endfunction
+
+    ## -*- texinfo -*-
+    ## @deftypefn  {ollama} {@var{id} =} queryAsync (@var{llm}, @var{prompt})
+    ## @deftypefnx {ollama} {@var{id} =} queryAsync (@var{llm}, @var{prompt}, @var{image})
+    ##
+    ## Query a model in ollama server asynchronously.
+    ##
+    ## @code{@var{id} = queryAsync (@var{llm}, @var{prompt})} sends the same
+    ## request as @code{query (@var{llm}, @var{prompt})}, but it returns
+    ## immediately without waiting for the response.  The request runs on a
+    ## background thread with its own connection to the ollama server, while
+    ## Octave remains available for other computations.  @var{id} is a numeric
+    ## handle to the pending request, which can be passed to the @code{poll},
+    ## @code{wait}, and @code{cancel} methods.  The response text is returned
+    ## by the @code{wait} method.
+    ##
+    ## @code{@var{id} = queryAsync (@var{llm}, @var{prompt}, @var{image})} also
+    ## specifies an image or multiple images to be passed to the model along
+    ## with the user's prompt in the same way as in the @code{query} method.
+    ##
+    ## @seealso{chatAsync, embedAsync, poll, wait, cancel}
+    ## @end deftypefn
+    function id = queryAsync (this, varargin)
+      ## Check active model exists
+      if (isempty (this.activeModel))
+        error ("ollama.queryAsync: no model has been loaded yet.");
       endif
-      ## Check dims
-      if (! isscalar (dims) || fix (dims) != dims || dims < 0)
-        error ("ollama.embed: DIMS must be a nonnegative integer scalar value.");
+      if (nargin < 2)
+        error ("ollama.queryAsync: too few input arguments.");
       endif
-      ## Run inference
-      [out, err] = __ollama__ ('model', this.activeModel, ...
-                               'serverURL', this.serverURL, ...
-                               'readTimeout', this.readTimeout, ...
-                               'writeTimeout', this.writeTimeout, ...
-                               'options', this.options, ...
-                               'input', input, 'dimensions', int16 (dims));
+      args = query_args (this, 'queryAsync', varargin{:});
+      [id, err] = __ollama__ (args{:}, 'async', true);
       if (err)
-        error ("ollama.embed: %s", out);
+        error ("ollama.queryAsync: server is inaccessible at %s.", ...
+               this.serverURL);
       endif
-      ## Decode json output
-      this.responseStats = jsondecode (out, 'makeValidName', false);
-      ## Return embedding vectors
-      vectors = this.responseStats.embeddings;
+      this.pendingRequests(end+1) = struct ('id', id, 'type', 'query', ...
+                                            'message', {{}});
+    endfunction
+
+    ## -*- texinfo -*-
+    ## @deftypefn  {ollama} {@var{id} =} chatAsync (@var{llm}, @var{prompt})
+    ## @deftypefnx {ollama} {@var{id} =} chatAsync (@var{llm}, @var{prompt}, @var{image})
+    ## @deftypefnx {ollama} {@var{id} =} chatAsync (@var{llm}, @{@var{tool_output}@})
+    ##
+    ## Chat with a model in ollama server asynchronously.
+    ##
+    ## @code{@var{id} = chatAsync (@dots{})} sends the same request as the
+    ## @code{chat} method with the same input arguments, but it returns
+    ## immediately without waiting for the response.  @var{id} is a numeric
+    ## handle to the pending request, which can be passed to the @code{poll},
+    ## @code{wait}, and @code{cancel} methods.  The chat history is updated
+    ## once the response is retrieved with the @code{wait} method.  Only a
+    ## single asynchronous chat request may be pending at a time, since every
+    ## chat request depends on the previous chat history.
+    ##
+    ## @seealso{queryAsync, embedAsync, poll, wait, cancel}
+    ## @end deftypefn
+    function id = chatAsync (this, varargin)
+      ## Check active model exists
+      if (isempty (this.activeModel))
+        error ("ollama.chatAsync: no model has been loaded yet.");
+      endif
+      if (nargin < 2)
+        error ("ollama.chatAsync: too few input arguments.");
+      endif
+      if (any (strcmp ({this.pendingRequests.type}, 'chat')))
+        error ("ollama.chatAsync: another chat request is still pending.");
+      endif
+      [args, message] = chat_args (this, 'chatAsync', varargin{:});
+      [id, err] = __ollama__ (args{:}, 'async', true);
+      if (err)
+        error ("ollama.chatAsync: server is inaccessible at %s.", ...
+               this.serverURL);
+      endif
+      this.pendingRequests(end+1) = struct ('id', id, 'type', 'chat', ...
+                                            'message', {message});
+    endfunction
+
+    ## -*- texinfo -*-
+    ## @deftypefn  {ollama} {@var{id} =} embedAsync (@var{llm}, @var{input})
+    ## @deftypefnx {ollama} {@var{id} =} embedAsync (@var{llm}, @var{input}, @var{dims})
+    ## @deftypefnx {ollama} {@var{id} =} embedAsync (@dots{}, @var{Name}, @var{Value})
+    ##
+    ## Generate embeddings asynchronously.
+    ##
+    ## @code{@var{id} = embedAsync (@dots{})} sends the same request as the
+    ## @code{embed} method with the same input arguments, but it returns
+    ## immediately without waiting for the response.  @var{id} is a numeric
+    ## handle to the pending request, which can be passed to the @code{poll},
+    ## @code{wait}, and @code{cancel} methods.  The embedding vectors are
+    ## returned by the @code{wait} method.
+    ##
+    ## @seealso{queryAsync, chatAsync, poll, wait, cancel}
+    ## @end deftypefn
+    function id = embedAsync (this, input, dims = 0, varargin)
+      ## Check active model exists and has embeding capabilities
+      if (isempty (this.activeModel))
+        error ("ollama.embedAsync: no model has been loaded yet.");
+      endif
+      if (! strcmp (this.mode, 'embed'))
+        error ("ollama.embedAsync: active model has no embedding capabilities.");
+      endif
+      args = embed_args (this, 'embedAsync', input, dims, varargin{:});
+      [id, err] = __ollama__ (args{:}, 'async', true);
+      if (err)
+        error ("ollama.embedAsync: server is inaccessible at %s.", ...
+               this.serverURL);
+      endif
+      this.pendingRequests(end+1) = struct ('id', id, 'type', 'embed', ...
+                                            'message', {{}});
+    endfunction
+
+    ## -*- texinfo -*-
+    ## @deftypefn {ollama} {[@var{done}, @var{txt}] =} poll (@var{llm}, @var{id})
+    ##
+    ## Check the status of an asynchronous request.
+    ##
+    ## @code{[@var{done}, @var{txt}] = poll (@var{llm}, @var{id})} returns a
+    ## logical scalar @var{done}, which is @qcode{true} when the asynchronous
+    ## request specified by the handle @var{id} has been completed, and a
+    ## character vector @var{txt} with the response tokens that have been
+    ## received since the previous call to @code{poll}.  Embedding requests do
+    ## not return any tokens.  Once a request is completed, use the @code{wait}
+    ## method to retrieve its response.
+    ##
+    ## @seealso{queryAsync, chatAsync, embedAsync, wait, cancel}
+    ## @end deftypefn
+    function [done, txt] = poll (this, id)
+      find_request (this, 'poll', id);
+      [status, err] = __ollama__ ('poll', id);
+      done = status.done;
+      txt = status.text;
+    endfunction
+
+    ## -*- texinfo -*-
+    ## @deftypefn {ollama} {@var{out} =} wait (@var{llm}, @var{id})
+    ##
+    ## Wait for an asynchronous request to complete.
+    ##
+    ## @code{@var{out} = wait (@var{llm}, @var{id})} blocks until the
+    ## asynchronous request specified by the handle @var{id} is completed and
+    ## returns its response in @var{out}, which is the same output returned by
+    ## the respective @code{query}, @code{chat}, or @code{embed} method.  The
+    ## @qcode{responseStats} property, and the chat history for chat requests,
+    ## are updated accordingly.  The handle @var{id} is released afterwards.
+    ##
+    ## @seealso{queryAsync, chatAsync, embedAsync, poll, cancel}
+    ## @end deftypefn
+    function out = wait (this, id)
+      idx = find_request (this, 'wait', id);
+      request = this.pendingRequests(idx);
+      [out, err, stats] = __ollama__ ('wait', id);
+      this.pendingRequests(idx) = [];
+      if (err)
+        error ("ollama.wait: %s", out);
+      endif
+      switch (request.type)
+        case 'query'
+          out = query_output (this, out);
+        case 'chat'
+          message = chat_output (this, out, request.message);
+          out = message{end,3};
+        case 'embed'
+          out = embed_output (this, out, stats);
+      endswitch
+    endfunction
+
+    ## -*- texinfo -*-
+    ## @deftypefn {ollama} {} cancel (@var{llm}, @var{id})
+    ##
+    ## Cancel an asynchronous request.
+    ##
+    ## @code{cancel (@var{llm}, @var{id})} aborts the asynchronous request
+    ## specified by the handle @var{id} and releases the handle.  Any partial
+    ## response is discarded and the chat history is not modified.
+    ##
+    ## @seealso{queryAsync, chatAsync, embedAsync, poll, wait}
+    ## @end deftypefn
+    function cancel (this, id)
+      idx = find_request (this, 'cancel', id);
+      [out, err] = __ollama__ ('cancel', id);
+      this.pendingRequests(idx) = [];
     endfunction
 
     ## -*- texinfo -*-
@@ -1442,9 +1823,18 @@ classdef ollama < handle
     ## response.
     ## @end itemize
     ##
+    ## If the response cache is enabled, @code{showStats} also displays the
+    ## number of requests answered from the cache (hits) and sent to the
+    ## ollama server (misses) during the current session.
+    ##
+    ## After a @code{query} or @code{chat} request, @code{showStats} also
+    ## displays the time spent by the client preparing the request, waiting
+    ## for the server's first response byte, receiving the response, and
+    ## decoding it, which helps telling apart client and server delays.
+    ##
     ## @end deftypefn
     function showStats (this)
-      RS = this.responseStats;
+      RS = response_stats (this);
       if (isempty (fieldnames (RS)))
         disp ("No stats to show. Make a query first or start a chat.");
         return;
@@ -1460,6 +1850,23 @@ classdef ollama < handle
       fprintf ("%+25s: %d (tokens)\n", 'Prompt count', ...
                RS.prompt_eval_count);
       fprintf ("%+25s: %d (tokens)\n\n", 'Evaluation count', RS.eval_count);
+      if (this.responseCache > 0 || ! isempty (this.responseCacheDir))
+        [CS, err] = __ollama__ ('Query', 'cacheStats');
+        fprintf ("%+25s: %d (memory), %d (disk)\n", 'Cache hits', ...
+                 CS.memory_hits, CS.disk_hits);
+        fprintf ("%+25s: %d\n\n", 'Cache misses', CS.misses);
+      endif
+      CT = this.clientTiming;
+      if (! isempty (fieldnames (CT)))
+        fprintf ("%+25s: %0.4f (sec)\n", 'Client preparation', ...
+                 CT.parse + CT.marshal + CT.server);
+        fprintf ("%+25s: %0.4f (sec)\n", 'Connect and send', ...
+                 CT.connect + CT.send);
+        fprintf ("%+25s: %0.4f (sec)\n", 'Time to first byte', CT.wait);
+        fprintf ("%+25s: %0.4f (sec)\n", 'Receive', CT.receive);
+        fprintf ("%+25s: %0.4f (sec)\n\n", 'Output and decode', ...
+                 CT.output + CT.decode);
+      endif
     endfunction
 
     ## -*- texinfo -*-
@@ -1600,6 +2007,8 @@ classdef ollama < handle
     ##
     ## @end deftypefn
     function clearHistory (this, idx = 'all')
+      ## Chat history must be marshalled again from scratch
+      close_session (this);
       H = this.chatHistory;
       if (isempty (H))
         return;
@@ -1625,6 +2034,15 @@ classdef ollama < handle
 
   methods (Hidden)
 
+    ## Cancel any pending asynchronous requests
+    function delete (this)
+      for id = [this.pendingRequests.id]
+        [out, err] = __ollama__ ('cancel', id);
+      endfor
+      set_keep_warm (this, false);
+      close_session (this);
+    endfunction
+
     ## Class specific display methods
     function display (this)
       in_name = inputname (1);
@@ -1649,6 +2067,15 @@ classdef ollama < handle
       endif
       fprintf ("%+25s: %d (sec)\n", 'readTimeout', this.readTimeout);
       fprintf ("%+25s: %d (sec)\n", 'writeTimeout', this.writeTimeout);
+      fprintf ("%+25s: '%s'\n", 'compression', this.compression);
+      if (ischar (this.healthCheck))
+        fprintf ("%+25s: '%s'\n", 'healthCheck', this.healthCheck);
+      else
+        fprintf ("%+25s: %g (sec)\n", 'healthCheck', this.healthCheck);
+      endif
+      if (! isempty (this.serverPool))
+        fprintf ("%+25s: %s\n", 'serverPool', strjoin (this.serverPool, ', '));
+      endif
       if (length (this.systemMessage) <= 60)
         fprintf ("%+25s: '%s'\n", 'systemMessage', this.systemMessage);
       else
@@ -1718,7 +2145,7 @@ classdef ollama < handle
             case 'availableModels'
               out = this.availableModels;
             case 'responseStats'
-              out = this.responseStats;
+              out = response_stats (this);
             case 'chatHistory'
               out = this.chatHistory;
             case 'activeModel'
@@ -1727,6 +2154,18 @@ classdef ollama < handle
               out = this.readTimeout;
             case 'writeTimeout'
               out = this.writeTimeout;
+            case 'compression'
+              out = this.compression;
+            case 'healthCheck'
+              out = this.healthCheck;
+            case 'serverPool'
+              out = this.serverPool;
+            case 'embeddingCache'
+              out = this.embeddingCache;
+            case 'responseCache'
+              out = this.responseCache;
+            case 'responseCacheDir'
+              out = this.responseCacheDir;
             case 'options'
               out = this.options;
             case 'system'
@@ -1735,6 +2174,16 @@ classdef ollama < handle
               out = this.thinking;
             case 'tools'
               out = this.tools;
+            case 'streamFunction'
+              out = this.streamFunction;
+            case 'keepContext'
+              out = this.keepContext;
+            case 'imageMaxSize'
+              out = this.imageMaxSize;
+            case 'keepAlive'
+              out = this.keepAlive;
+            case 'keepWarm'
+              out = this.keepWarm;
             otherwise
               error ("ollama.subsref: unrecongized property: '%s'", s.subs);
           endswitch
@@ -1794,6 +2243,63 @@ classdef ollama < handle
                 error (strcat ("ollama.subsref: 'writeTimeout' must be", ...
                                " a scalar with positive integer value."));
               endif
+            case 'compression'
+              if (ischar (val) && any (strcmp (val, {'none', 'response', 'all'})))
+                this.compression = val;
+              else
+                error (strcat ("ollama.subsref: 'compression' must be", ...
+                               " 'none', 'response', or 'all'."));
+              endif
+            case 'embeddingCache'
+              if (isempty (val))
+                this.embeddingCache = '';
+              elseif (ischar (val) && isvector (val))
+                this.embeddingCache = val;
+              else
+                error (strcat ("ollama.subsref: 'embeddingCache' must", ...
+                               " be a character vector."));
+              endif
+            case 'responseCache'
+              if (isscalar (val) && isnumeric (val) && val >= 0 ...
+                                 && fix (val) == val)
+                this.responseCache = val;
+              else
+                error (strcat ("ollama.subsref: 'responseCache' must be", ...
+                               " a scalar with nonnegative integer value."));
+              endif
+            case 'responseCacheDir'
+              if (isempty (val))
+                this.responseCacheDir = '';
+              elseif (ischar (val) && isvector (val))
+                if (! isfolder (val))
+                  [status, msg] = mkdir (val);
+                  if (! status)
+                    error ("ollama.subsref: cannot create '%s': %s", val, msg);
+                  endif
+                endif
+                this.responseCacheDir = val;
+              else
+                error (strcat ("ollama.subsref: 'responseCacheDir' must", ...
+                               " be a character vector."));
+              endif
+            case 'healthCheck'
+              if (isscalar (val) && isnumeric (val) && val >= 0)
+                this.healthCheck = val;
+              elseif (strcmp (val, 'lazy'))
+                this.healthCheck = 'lazy';
+              else
+                error (strcat ("ollama.subsref: 'healthCheck' must be either", ...
+                               " a nonnegative scalar or 'lazy'."));
+              endif
+            case 'serverPool'
+              if (iscellstr (val) && all (cellfun (@(x) ! isempty (x), val)))
+                this.serverPool = val(:)';
+              elseif (isempty (val))
+                this.serverPool = {};
+              else
+                error (strcat ("ollama.subsref: 'serverPool' must be a", ...
+                               " cell array of server URLs."));
+              endif
             case 'options'
               if (iscell (val) && numel (val) == 2)
                 setOptions (this, val{1}, val{2});
@@ -1841,10 +2347,57 @@ classdef ollama < handle
                                  " model does not support 'tools'"));
                 endif
                 this.tools = val;
+                if (isa (val, 'toolFunction'))
+                  this.toolsJSON = jsonencode ({encodeFunction(val)});
+                else
+                  this.toolsJSON = jsonencode (encodeRegistry(val));
+                endif
               else
                 error (strcat ("ollama.subsref: 'tool' must be either a", ...
                                " 'toolFunction' or a 'toolRegistry' object."));
               endif
+            case 'streamFunction'
+              if (isempty (val) || is_function_handle (val))
+                this.streamFunction = val;
+              else
+                error (strcat ("ollama.subsref: 'streamFunction' must be", ...
+                               " either empty or a function handle."));
+              endif
+            case 'keepContext'
+              if (isscalar (val) && islogical (val))
+                close_session (this);
+                this.keepContext = val;
+              else
+                error ("ollama.subsref: 'keepContext' must be a logical scalar.");
+              endif
+            case 'imageMaxSize'
+              if (isscalar (val) && isnumeric (val) && val >= 0 ...
+                                 && fix (val) == val)
+                this.imageMaxSize = val;
+              else
+                error (strcat ("ollama.subsref: 'imageMaxSize' must be", ...
+                               " a scalar with nonnegative integer value."));
+              endif
+            case 'keepAlive'
+              if ((ischar (val) && isvector (val)) ...
+                  || (isscalar (val) && isnumeric (val) && isreal (val)))
+                this.keepAlive = val;
+                ## Restart keeping the model warm for the new duration
+                if (this.keepWarm)
+                  set_keep_warm (this, true);
+                endif
+              else
+                error (strcat ("ollama.subsref: 'keepAlive' must be either", ...
+                               " a duration character vector or a real", ...
+                               " scalar in seconds."));
+              endif
+            case 'keepWarm'
+              if (isscalar (val) && (islogical (val) || isnumeric (val)))
+                this.keepWarm = logical (val);
+                set_keep_warm (this, this.keepWarm);
+              else
+                error ("ollama.subsref: 'keepWarm' must be a logical scalar.");
+              endif
             otherwise
               error ("ollama.subsasgn: unrecongized property: %s", s.subs);
           endswitch
@@ -1856,128 +2409,447 @@ classdef ollama < handle
 
   methods (Access = private)
 
-    ## Function for check if the active model has embedding capabilities
-    function out = checkEmbedding (this)
-      [out, err] = __ollama__ ('modelInfo', this.activeModel, ...
-                               'serverURL', this.serverURL);
-      if (err)
-        error ("ollama: could not get MODEL info for '%s'", model);
-      else
-        ## Search the capabilities field for thiking
-        if (ismember ('embedding', jsondecode (out).capabilities))
-          out = true;
+    ## Get thinking status as a character vector
+    function think = think_status (this)
+      if (islogical (this.thinking))
+        if (this.thinking)
+          think = 'true';
         else
-          out = false;
+          think = 'false';
         endif
+      else
+        think = this.thinking;
       endif
     endfunction
 
-    ## Function for check if the active model has thinking capabilities
-    function out = checkThinking (this)
-      [out, err] = __ollama__ ('modelInfo', this.activeModel, ...
-                               'serverURL', this.serverURL);
-      if (err)
-        error ("ollama: could not get MODEL info for '%s'", model);
-      else
-        ## Search the capabilities field for thiking
-        if (ismember ('thinking', jsondecode (out).capabilities))
-          out = true;
-        else
-          out = false;
+    ## Helper function for parsing the input arguments of a query request
+    function args = query_args (this, fname, varargin)
+      ## Validate user prompt
+      prompt = varargin{1};
+      if (! (isvector (prompt) && ischar (prompt)))
+        error ("ollama.%s: PROMPT must be a character vector.", fname);
+      endif
+      args = {'prompt', prompt};
+      ## Validate any images
+      if (numel (varargin) > 1)
+        image = varargin{2};
+        if (! ischar (image) && ! iscellstr (image) && ! isvector (image))
+          error (strcat ("ollama.%s: IMAGE must be either a character", ...
+                         " vector or a cell array of character vectors."), ...
+                 fname);
         endif
+        ## Check for either imageFile or imageBase64 strings
+        if (ischar (image))
+          if (any ('.' == image))
+            type = 'imageFile';
+          else
+            type = 'imageBase64';
+          endif
+        else  # cellstr
+          fcn = @(x) any ('.' == x);
+          TF = cellfun (fcn, image);
+          if (all (TF))
+            type = 'imageFile';
+          elseif (! any (TF))
+            type = 'imageBase64';
+          else
+            error (strcat ("ollama.%s: IMAGE must either contain", ...
+                           " file names or base64_encoded strings."), fname);
+          endif
+        endif
+        args = [args, {type, image}];
       endif
+      ## Request settings are stored in the native session, which continues
+      ## from the previous context (if requested)
+      args = [session_args(this), args];
     endfunction
 
-    ## Function for check if a model has tool-calling capabilities
-    function out = checkToolCalling (this)
-      [out, err] = __ollama__ ('modelInfo', this.activeModel, ...
-                               'serverURL', this.serverURL);
-      if (err)
-        error ("ollama: could not get MODEL info for '%s'", model);
-      else
-        ## Search the capabilities field for thiking
-        if (ismember ('tools', jsondecode (out).capabilities))
-          out = true;
-        else
-          out = false;
+    ## Helper function for passing the settings shared by all query and chat
+    ## requests through the native session, where they are only stored again
+    ## after any of them has changed
+    function args = session_args (this)
+      settings = [{'model', this.activeModel, ...
+                   'serverURL', this.serverURL, ...
+                   'readTimeout', this.readTimeout, ...
+                   'writeTimeout', this.writeTimeout, ...
+                   'compression', this.compression, ...
+                   'healthCheck', this.healthCheck, ...
+                   'options', this.options, ...
+                   'systemMessage', this.systemMessage, ...
+                   'think', think_status(this), 'tools', this.toolsJSON, ...
+                   'imageMaxSize', this.imageMaxSize, ...
+                   'keepAlive', this.keepAlive, ...
+                   'sessionContext', logical(this.keepContext)}, ...
+                  server_pool_args(this), response_cache_args(this)];
+      id = chat_session (this);
+      if (! isequal (settings, this.sessionSettings))
+        [out, err] = __ollama__ ('configureSession', id, settings{:});
+        this.sessionSettings = settings;
+      endif
+      args = {'session', id};
+    endfunction
+
+    ## Helper function for getting the statistics of the last response, which
+    ## are only decoded from the native session when they are requested
+    function stats = response_stats (this)
+      if (this.responsePending)
+        this.responsePending = false;
+        [out, err] = __ollama__ ('sessionResponse', this.sessionID);
+        if (! err)
+          this.responseStats = jsondecode (out, 'makeValidName', false);
         endif
       endif
+      stats = this.responseStats;
     endfunction
 
-    ## Helper function for listing available and running models
-    function [list, err] = do_list_models (this, mode, operation)
-      if (! any (strcmp (mode, {'cellstr', 'json', 'table'})))
-        err = sprintf ("ollama.%s: MODE can be either 'cellstr' or 'json'.", ...
-                       operation);
+    ## Helper function for getting the native chat session (created on demand)
+    function id = chat_session (this)
+      if (this.sessionID == 0)
+        [id, err] = __ollama__ ('newSession', true);
+        this.sessionID = id;
+        this.sessionSettings = {};
+      endif
+      id = this.sessionID;
+    endfunction
+
+    ## Helper function for releasing the native chat session
+    function close_session (this)
+      if (this.sessionID != 0)
+        ## Keep the statistics of the last response
+        response_stats (this);
+        [out, err] = __ollama__ ('closeSession', this.sessionID);
+        this.sessionID = 0;
+      endif
+    endfunction
+
+    ## Helper function for starting or stopping keeping the active model warm
+    function set_keep_warm (this, enable)
+      if (isempty (this.activeModel))
+        return;
       endif
-      if (strcmp (mode, 'table'))
-        mode = 'json';
-        return_table = true;
+      [out, err] = __ollama__ ('keepWarm', logical (enable), ...
+                               'model', this.activeModel, ...
+                               'serverURL', this.serverURL, ...
+                               'keepAlive', this.keepAlive, ...
+                               'embeddingModel', strcmp (this.mode, 'embed'));
+    endfunction
+
+    ## Helper function for passing the server pool (if any)
+    function args = server_pool_args (this)
+      if (isempty (this.serverPool))
+        args = {};
       else
-        return_table = false;
+        args = {'serverPool', this.serverPool};
       endif
-      [list, err] = __ollama__ (operation, mode, 'serverURL', this.serverURL);
-      if (err)
-        this = [];
-        err = sprintf ("ollama.%s: server is inaccessible at %s.", ...
-                       operation, serverURL);
+    endfunction
+
+    ## Helper function for passing the response cache settings
+    function args = response_cache_args (this)
+      args = {'responseCache', this.responseCache};
+      if (! isempty (this.responseCacheDir))
+        args = [args, {'responseCacheDir', this.responseCacheDir}];
+      endif
+    endfunction
+
+    ## Helper function for decoding the response of a query request
+    function out = query_output (this, out)
+      if (isstruct (out))
+        ## Only the text of the response is returned by the native session
+        this.responsePending = true;
+        response = out.response;
+        thinking = out.thinking;
+      else
+        ## Decode json output
+        this.responseStats = jsondecode (out);
+        this.responsePending = false;
+        response = this.responseStats.response;
+        if (this.thinking)
+          thinking = this.responseStats.thinking;
+        endif
+      endif
+      ## Get output
+      if (this.thinking)
+        out = {strtrim(response); strtrim(thinking)};
       else
-        if (strcmp (mode, 'cellstr'))
-          if (strcmp (operation, 'listModels'))
-            this.availableModels = list;
-          else    # listRunningModels
-            this.runningModels = list;
+        out = strtrim (response);
+      endif
+    endfunction
+
+    ## Helper function for parsing the input arguments of a chat request
+    function [args, message] = chat_args (this, fname, varargin)
+      ## Initialize new chat or use previous history
+      message = {'', {'', ''}, {''; ''; ''}};
+      if (! isempty (this.chatHistory))
+        message = [this.chatHistory; message];
+      endif
+      ## Validate first input either as "role:user" or as "role:tool"
+      if (numel (varargin) > 0)
+        prompt = varargin{1};
+        if (isempty (this.tools))
+          if (isvector (prompt) && ischar (prompt))
+            message(end, 1) = prompt;
+          else
+            error ("ollama.%s: PROMPT must be a character vector.", fname);
           endif
         else
-          list = jsondecode (list);
-          if (strcmp (operation, 'listModels'))
-            if (isempty (list.models))
-              this.availableModels = {''};
-            else
-              this.availableModels = {list.models.model}';
-            endif
-          else    # listRunningModels
-            if (isempty (list.models))
-              this.runningModels = {''};
+          if (isvector (prompt) && ischar (prompt))
+            message(end, 1) = prompt;
+          elseif (columns (prompt) == 2 && iscellstr (prompt))
+            message(end, 1) = prompt;
+          else
+            error (strcat ("ollama.%s: first input argument must be", ...
+                           " either a character vector or a two-column", ...
+                           " cell array of character vectors."), fname);
+          endif
+        endif
+      endif
+      ## Validate any images
+      if (numel (varargin) > 1)
+        image = varargin{2};
+        if (! ischar (image) && ! iscellstr (image) && ! isvector (image))
+          error (strcat ("ollama.%s: IMAGE must be either a character", ...
+                         " vector or a cell array of character vectors."), ...
+                 fname);
+        endif
+        ## Check for either imageFile or imageBase64 strings
+        if (ischar (image))
+          if (any ('.' == image))
+            message{end, 2}(1) = 'imageFile';
+          else
+            message{end, 2}(1) = 'imageBase64';
+          endif
+          message{end, 2}(2) = image;
+        else  # cellstr
+          fcn = @(x) any ('.' == x);
+          TF = cellfun (fcn, image);
+          for img = 1:numel (TF)
+            if (TF(img))
+              message{end, 2}(img, 1) = 'imageFile';
             else
-              this.runningModels = {list.models.model}';
+              message{end, 2}(img, 1) = 'imageBase64';
             endif
+            message{end, 2}(img, 2) = image{img};
+          endfor
+        endif
+      endif
+      ## Request settings are stored in the native session, which marshals only
+      ## the rows appended to the chat history since the previous request
+      args = [session_args(this), {'message', message}];
+    endfunction
+
+    ## Helper function for decoding the response of a chat request and
+    ## appending it to the chat history
+    function [message, tool_calls] = chat_output (this, out, message)
+      tool_calls = '';
+      if (isstruct (out))
+        ## Only the text of the response is returned by the native session
+        this.responsePending = true;
+        content = out.content;
+        thinking = out.thinking;
+        if (! isempty (this.tools) && ! isempty (out.tool_calls))
+          tool_calls = jsondecode (out.tool_calls, 'makeValidName', false);
+        endif
+      else
+        ## Decode json output
+        this.responseStats = jsondecode (out, 'makeValidName', false);
+        this.responsePending = false;
+        content = this.responseStats.message.content;
+        ## Grab tool_calls (if any)
+        if (! isempty (this.tools))
+          if (ismember (fieldnames (this.responseStats.message), 'tool_calls'))
+            tool_calls = this.responseStats.message.tool_calls;
           endif
         endif
-        ## Create table if requested
-        if (return_table)
-          if (isempty (list.models))
-            list = table ('Size', [0, 5], 'VariableTypes', {'cellstr', ...
-                          'cellstr', 'cellstr', 'cellstr', 'double'}, ...
-                          'VariableNames', {'family', 'format', 'parameter', ...
-                          'quantization', 'size'});
-            if (strcmp (operation, 'listModels'))
-              this.availableModels = {''};
-            else    # listRunningModels
-              this.runningModels = {''};
+        if (this.thinking || ! isempty (tool_calls))
+          thinking = this.responseStats.message.thinking;
+        endif
+      endif
+      ## Add response to chat history
+      if (this.thinking || ! isempty (tool_calls))
+        message{end,3}(1) = strtrim (content);
+        message{end,3}(2) = strtrim (thinking);
+        message{end,3}(3) = jsonencode (tool_calls);
+      else
+        message(end,3) = strtrim (content);
+      endif
+      this.chatHistory = message;
+    endfunction
+
+    ## Helper function for parsing the input arguments of an embed request
+    function args = embed_args (this, fname, input, dims, varargin)
+      ## Check input
+      if (isempty (input))
+        error ("ollama.%s: INPUT cannot be empty.", fname);
+      endif
+      if (ischar (input) && isvector (input) || isa (input, 'string'))
+        input = cellstr (input);
+      endif
+      if (! iscellstr (input) || any (cellfun ('isempty', input)))
+        error (strcat ("ollama.%s: INPUT must be a non-empty character", ...
+                       " vector or a cell array of non-empty character", ...
+                       " vectors."), fname);
+      endif
+      ## Check dims
+      if (isempty (dims))
+        dims = 0;
+      endif
+      if (! isscalar (dims) || fix (dims) != dims || dims < 0)
+        error ("ollama.%s: DIMS must be a nonnegative integer scalar value.", ...
+               fname);
+      endif
+      args = {'model', this.activeModel, ...
+              'serverURL', this.serverURL, ...
+              'readTimeout', this.readTimeout, ...
+              'writeTimeout', this.writeTimeout, ...
+              'compression', this.compression, ...
+              'healthCheck', this.healthCheck, ...
+              'options', this.options, ...
+              'input', input, 'dimensions', int16(dims), ...
+              'keepAlive', this.keepAlive};
+      args = [args, server_pool_args(this)];
+      ## Asynchronous requests do not use the embedding cache
+      if (! isempty (this.embeddingCache) && strcmp (fname, 'embed'))
+        args = [args, {'embeddingCache', this.embeddingCache}];
+      endif
+      ## Parse optional Name-Value paired arguments
+      if (mod (numel (varargin), 2) != 0)
+        error ("ollama.%s: optional arguments must be in Name-Value pairs.", ...
+               fname);
+      endif
+      for i = 1:2:numel (varargin)
+        switch (lower (varargin{i}))
+          case 'precision'
+            if (! any (strcmp (varargin{i+1}, {'double', 'single'})))
+              error ("ollama.%s: 'precision' must be 'double' or 'single'.", ...
+                     fname);
             endif
-          else
-            T = struct2table (list.models);
-            T = removevars (T, {'digest', 'name'});
-            list = struct2table (T.details, 'AsArray', true);
-            list = removevars (list, {'families', 'parent_model'});
-            list = renamevars (list, 'quantization_level', 'quantization');
-            list = renamevars (list, 'parameter_size', 'parameter');
-            list = addvars (list, T.size, 'NewVariableNames', 'size');
-            list.Properties.RowNames = T.model;
-            if (strcmp (operation, 'listModels'))
-              this.availableModels = T.model;
-            else    # listRunningModels
-              this.runningModels = T.model;
+            args = [args, {'precision', varargin{i+1}}];
+          case {'chunksize', 'chunkchars', 'retries'}
+            val = varargin{i+1};
+            if (! (isscalar (val) && isnumeric (val) && fix (val) == val ...
+                   && val >= 0))
+              error ("ollama.%s: '%s' must be a nonnegative integer.", ...
+                     fname, varargin{i});
             endif
-          endif
+            names = {'chunkSize', 'chunkChars', 'retries'};
+            name = names{strcmpi (varargin{i}, names)};
+            args = [args, {name, double(val)}];
+          case 'concurrency'
+            val = varargin{i+1};
+            if (! (isscalar (val) && isnumeric (val) && fix (val) == val ...
+                   && val >= 1))
+              error ("ollama.%s: 'concurrency' must be a positive integer.", ...
+                     fname);
+            endif
+            args = [args, {'concurrency', double(val)}];
+          otherwise
+            error ("ollama.%s: invalid parameter name: '%s'.", ...
+                   fname, varargin{i});
+        endswitch
+      endfor
+    endfunction
+
+    ## Helper function for decoding the response of an embed request
+    function vectors = embed_output (this, vectors, stats)
+      ## Embedding vectors are returned as a numeric matrix
+      stats.embeddings = vectors;
+      this.responseStats = stats;
+      this.responsePending = false;
+    endfunction
+
+    ## Helper function for finding a pending asynchronous request
+    function idx = find_request (this, fname, id)
+      if (! (isscalar (id) && isnumeric (id)))
+        error ("ollama.%s: ID must be a numeric scalar.", fname);
+      endif
+      idx = find ([this.pendingRequests.id] == id);
+      if (isempty (idx))
+        error ("ollama.%s: there is no pending request with ID %d.", fname, id);
+      endif
+    endfunction
+
+    ## Helper function for getting the capabilities of the active model
+    function caps = model_capabilities (this)
+      [caps, err] = __ollama__ ('modelCapabilities', this.activeModel, ...
+                                'serverURL', this.serverURL);
+      if (err)
+        error ("ollama: could not get MODEL info for '%s': %s", ...
+               this.activeModel, caps);
+      endif
+    endfunction
+
+    ## Function for check if the active model has embedding capabilities
+    function out = checkEmbedding (this)
+      out = model_capabilities (this).embedding;
+    endfunction
+
+    ## Function for check if the active model has thinking capabilities
+    function out = checkThinking (this)
+      out = model_capabilities (this).thinking;
+    endfunction
+
+    ## Function for check if a model has tool-calling capabilities
+    function out = checkToolCalling (this)
+      out = model_capabilities (this).tools;
+    endfunction
+
+    ## Helper function for listing available and running models
+    function [list, err] = do_list_models (this, mode, operation)
+      if (! any (strcmp (mode, {'cellstr', 'json', 'table'})))
+        err = sprintf (strcat ("ollama.%s: MODE can be either 'cellstr',", ...
+                               " 'json', or 'table'."), operation);
+        list = [];
+        return;
+      endif
+      [list, err] = __ollama__ (operation, mode, 'serverURL', this.serverURL);
+      if (err)
+        err = sprintf ("ollama.%s: server is inaccessible at %s.", ...
+                       operation, this.serverURL);
+        return;
+      endif
+      if (strcmp (mode, 'cellstr'))
+        names = list;
+      elseif (strcmp (mode, 'json'))
+        models = jsondecode (list).models;
+        if (isempty (models))
+          names = {''};
+        else
+          names = {models.model}';
+        endif
+      else
+        ## The columns of the table are built by __ollama__
+        names = list.model;
+        list = table (list.family, list.format, list.parameter, ...
+                      list.quantization, list.size, 'VariableNames', ...
+                      {'family', 'format', 'parameter', 'quantization', ...
+                      'size'});
+        if (isempty (names))
+          names = {''};
+        else
+          list.Properties.RowNames = names;
         endif
       endif
+      if (strcmp (operation, 'listModels'))
+        this.availableModels = names;
+      else    # listRunningModels
+        this.runningModels = names;
+      endif
     endfunction
   endmethods
 
 endclassdef
 
+## Print the status of a model download on a single line
+function print_pull_progress (status)
+  if (status.total > 0)
+    fprintf ("\r%s %5.1f%%", status.status, ...
+             100 * status.completed / status.total);
+  else
+    fprintf ("\r%-60s", status.status);
+  endif
+  fflush (stdout);
+endfunction
+
 ## Private function for printing inference text output within the screen's limit
 function __disp__ (txt)
   ## Get screen size to trim lines to
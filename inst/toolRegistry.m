@@ -80,7 +80,8 @@ classdef toolRegistry
     endfunction
 
     ## -*- texinfo -*-
-    ## @deftypefn {toolFunction} {@var{tool_output} =} evalFunction (@var{reg}, @var{tool_call})
+    ## @deftypefn  {toolFunction} {@var{tool_output} =} evalFunction (@var{reg}, @var{tool_call})
+    ## @deftypefnx {toolFunction} {@var{tool_output} =} evalFunction (@var{reg}, @var{tool_call}, @var{nproc})
     ##
     ## Evaluate the requested tool functions in the tool registry.
     ##
@@ -95,8 +96,22 @@ classdef toolRegistry
     ## contains the output of each evaluated @qcode{toolFunction} object and the
     ## second column contains the corresponding function names.
     ##
+    ## @code{@var{tool_output} = evalFunction (@var{reg}, @var{tool_call},
+    ## @var{nproc})} evaluates the requested tool functions concurrently in up
+    ## to @var{nproc} separate processes with @code{parcellfun} from the
+    ## @qcode{parallel} package, which is useful when the model requests
+    ## several independent tools that spend most of their time waiting for I/O.
+    ## The rows of @var{tool_output} are returned in the same order as the tool
+    ## calls.  Since each tool function is evaluated in a child process, any
+    ## changes it makes to the workspace or to handle objects are not visible
+    ## in the calling process.  By default, @var{nproc} is 1 and the tool
+    ## functions are evaluated one after another.
+    ##
     ## @end deftypefn
-    function tool_output = evalFunction (this, tool_call)
+    function tool_output = evalFunction (this, tool_call, nproc)
+      if (nargin < 3)
+        nproc = 1;
+      endif
       if (! isstruct (tool_call))
         if (validateString (tool_call))
           error (strcat ("toolRegistry.evalFunction: unless a struct", ...
@@ -112,17 +127,44 @@ classdef toolRegistry
       if (! all (ismember (fieldnames (tool_call), {'type', 'function'})))
         error ("toolRegistry.evalFunction: invalid TOOL_CALL structure.");
       endif
-      tool_output = {};
-      for i = 1:numel (tool_call)
+      if (! (isscalar (nproc) && isnumeric (nproc) && nproc >= 1
+             && fix (nproc) == nproc))
+        error ("toolRegistry.evalFunction: NPROC must be a positive integer.");
+      endif
+      ## Find the requested tool functions before evaluating any of them
+      ncalls = numel (tool_call);
+      tools = cell (ncalls, 1);
+      calls = cell (ncalls, 1);
+      for i = 1:ncalls
         name = tool_call(i).function.name;
         tidx = strcmp (name, this.names);
-        if (any (tidx))
-          output = evalFunction (this.tools{tidx}, tool_call(i));
-          tool_output = [tool_output; output];
-        else
+        if (! any (tidx))
           error ("toolRegistry.evalFunction: unavailable toolFunction: '%s'", name);
         endif
+        tools{i} = this.tools{tidx};
+        calls{i} = tool_call(i);
       endfor
+      nproc = min (nproc, ncalls);
+      if (nproc > 1)
+        if (! exist ("parcellfun"))
+          try
+            pkg load parallel
+          catch
+            error (strcat ("toolRegistry.evalFunction: evaluating tool", ...
+                           " functions in parallel requires the", ...
+                           " 'parallel' package."));
+          end_try_catch
+        endif
+        output = parcellfun (nproc, @(t, c) evalFunction (t, c), tools, ...
+                             calls, 'UniformOutput', false, ...
+                             'VerboseLevel', 0);
+      else
+        output = cellfun (@(t, c) evalFunction (t, c), tools, calls, ...
+                          'UniformOutput', false);
+      endif
+      ## Tool calls with mismatching arguments return nothing
+      output = output(! cellfun ('isempty', output));
+      tool_output = vertcat ({}, output{:});
     endfunction
 
   endmethods
@@ -16,6 +16,8 @@ this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "./include/ollama.hpp"
+#include "./include/fpng.h"
+#include "./include/downscale.h"
 
 #include <iostream>
 #include <string>
@@ -23,17 +25,2496 @@ this program; if not, see <http://www.gnu.org/licenses/>.
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <list>
+#include <limits>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
 
 #include <octave/oct.h>
 #include <octave/Cell.h>
 #include <octave/ov-struct.h>
+#include <octave/parse.h>
 
 using namespace std;
 using json = nlohmann::json;
 
-DEFUN_DLD (__ollama__, args, nargout,
+// Copy the embedding vectors of the inputs begin to end-1 into their rows of
+// the NxD column-major array data.  Nothing is copied, and false is returned,
+// if the vectors do not match the expected number and dimension.
+template <typename T>
+static bool
+copy_rows (const json& embeddings, size_t begin, size_t end, T *data,
+           size_t n, size_t d)
+{
+  if (! embeddings.is_array () || embeddings.size () != end - begin)
+  {
+    return false;
+  }
+  for (const auto& vector : embeddings)
+  {
+    if (! vector.is_array () || vector.size () != d)
+    {
+      return false;
+    }
+  }
+  for (size_t i = begin; i < end; i++)
+  {
+    const json& vector = embeddings[i-begin];
+    for (size_t j = 0; j < d; j++)
+    {
+      data[i+j*n] = vector[j].get<T> ();
+    }
+  }
+  return true;
+}
+
+// Copy the embedding vectors of a response into an NxD numeric array, where N
+// is the number of inputs and D is the dimension of the embeddings.
+template <typename A>
+static A
+embedding_matrix (const json& embeddings)
+{
+  size_t n = embeddings.size ();
+  size_t d = n > 0 ? embeddings[0].size () : 0;
+  A vectors (dim_vector (n, d));
+  if (! copy_rows (embeddings, 0, n, vectors.fortran_vec (), n, d))
+  {
+    error ("__ollama__: embedding vectors have inconsistent dimensions.");
+  }
+  return vectors;
+}
+
+// Convert the scalar fields of a JSON response into a structure, skipping
+// the embedding vectors.
+static octave_scalar_map
+response_stats (const json& response)
+{
+  octave_scalar_map stats;
+  for (auto it = response.begin (); it != response.end (); ++it)
+  {
+    if (it.key () == "embeddings")
+    {
+      continue;
+    }
+    if (it->is_string ())
+    {
+      stats.setfield (it.key (), it->get<string> ());
+    }
+    else if (it->is_boolean ())
+    {
+      stats.setfield (it.key (), it->get<bool> ());
+    }
+    else if (it->is_number ())
+    {
+      stats.setfield (it.key (), it->get<double> ());
+    }
+  }
+  return stats;
+}
+
+// Return the embeddings of a response along with its statistics
+static void
+embedding_output (const ollama::response& response, bool single_precision,
+                  octave_value_list& retval)
+{
+  const json& reply = response.as_json ();
+  if (! reply.contains ("embeddings"))
+  {
+    retval(0) = "no embeddings returned from server.";
+    retval(1) = true;
+    return;
+  }
+  if (single_precision)
+  {
+    retval(0) = embedding_matrix<FloatNDArray> (reply["embeddings"]);
+  }
+  else
+  {
+    retval(0) = embedding_matrix<NDArray> (reply["embeddings"]);
+  }
+  retval(1) = false;
+  if (retval.length () > 2)
+  {
+    retval(2) = response_stats (reply);
+  }
+}
+
+// Whether a request failed because the server could not be reached, rather
+// than because the server rejected it
+static bool
+connection_failed (const exception& err)
+{
+  return strstr (err.what (), "No response returned") != nullptr;
+}
+
+// Asynchronous request running on a background worker thread with its own
+// connection to the server.  Streamed tokens are buffered until polled.  Once
+// the request ends, the finished callback (if any) is called from the worker
+// thread with the duration of the request in seconds, or -1 if it failed or
+// was canceled, and whether the server could not be reached.
+class async_request
+{
+public:
+
+  async_request (const Ollama& server) : client (server) {}
+
+  ~async_request ()
+  {
+    cancel ();
+  }
+
+  void start (ollama::request request)
+  {
+    worker = thread ([this, request] () mutable
+    {
+      auto start = chrono::steady_clock::now ();
+      double seconds = -1;
+      bool unreachable = false;
+      try
+      {
+        auto on_receive = [this] (const ollama::response& partial) -> bool
+        {
+          lock_guard<mutex> guard (lock);
+          tokens += partial.as_simple_string ();
+          return ! canceled;
+        };
+        type = request.get_type ();
+        if (type == ollama::message_type::generation)
+        {
+          response = client.generate (request, on_receive);
+        }
+        else if (type == ollama::message_type::chat)
+        {
+          response = client.chat (request, on_receive);
+        }
+        else
+        {
+          // Embeddings are converted into a numeric array once retrieved
+          response = client.generate_embeddings (request);
+        }
+        if (type != ollama::message_type::embedding)
+        {
+          result = response.as_json_string ();
+        }
+        if (! canceled)
+        {
+          seconds = chrono::duration<double>
+                    (chrono::steady_clock::now () - start).count ();
+        }
+      }
+      catch (exception& err)
+      {
+        result = err.what ();
+        failed = true;
+        unreachable = connection_failed (err);
+      }
+      if (finished)
+      {
+        finished (seconds, unreachable);
+      }
+      done = true;
+    });
+  }
+
+  // Return any tokens received since the last call
+  string poll ()
+  {
+    lock_guard<mutex> guard (lock);
+    string txt;
+    txt.swap (tokens);
+    return txt;
+  }
+
+  void cancel ()
+  {
+    canceled = true;
+    client.stop ();
+    if (worker.joinable ())
+    {
+      worker.join ();
+    }
+  }
+
+  void wait ()
+  {
+    worker.join ();
+  }
+
+  atomic<bool> done {false};
+  atomic<bool> canceled {false};
+  ollama::message_type type = ollama::message_type::generation;
+  ollama::response response;
+  string result;
+  bool failed = false;
+  bool single_precision = false;
+  function<void (double, bool)> finished;
+
+private:
+
+  Ollama client;
+  thread worker;
+  mutex lock;
+  string tokens;
+};
+
+// Parse a keep alive duration, given either as a number of seconds or as a
+// duration string in the format of the ollama server, such as "90s", "5m", or
+// "1h30m".  NaN is returned for an invalid string.
+static double
+keep_alive_seconds (const json& duration)
+{
+  if (duration.is_number ())
+  {
+    return duration.get<double> ();
+  }
+  const string str = duration.get<string> ();
+  double total = 0;
+  size_t pos = 0;
+  while (pos < str.size ())
+  {
+    size_t used = 0;
+    double value;
+    try
+    {
+      value = stod (str.substr (pos), &used);
+    }
+    catch (exception&)
+    {
+      return numeric_limits<double>::quiet_NaN ();
+    }
+    pos += used;
+    size_t unit_end = str.find_first_of ("0123456789.-+", pos);
+    string unit = str.substr (pos, unit_end - pos);
+    pos = unit_end == string::npos ? str.size () : unit_end;
+    if (unit == "h")
+    {
+      total += value * 3600;
+    }
+    else if (unit == "m")
+    {
+      total += value * 60;
+    }
+    else if (unit == "s" || (unit.empty () && pos == str.size ()))
+    {
+      total += value;
+    }
+    else if (unit == "ms")
+    {
+      total += value / 1e3;
+    }
+    else
+    {
+      return numeric_limits<double>::quiet_NaN ();
+    }
+  }
+  return total;
+}
+
+// Background thread that loads a model again every interval seconds, so that
+// the server does not unload it between requests.  Each thread uses its own
+// connection to the server and sleeps until it is either due or stopped.
+class keep_warm_task
+{
+public:
+
+  keep_warm_task (const Ollama& server, const string& model, bool embedding,
+                  const json& keep_alive, double interval)
+    : client (server)
+  {
+    worker = thread ([this, model, embedding, keep_alive, interval] ()
+    {
+      auto period = chrono::duration_cast<chrono::steady_clock::duration>
+                    (chrono::duration<double> (interval));
+      unique_lock<mutex> guard (lock);
+      while (! wake.wait_for (guard, period, [this] () { return stopped; }))
+      {
+        guard.unlock ();
+        try
+        {
+          client.load_model (model, embedding, keep_alive);
+        }
+        catch (exception&)
+        {
+          // The server may be restarting, so try again when next due
+        }
+        guard.lock ();
+      }
+    });
+  }
+
+  ~keep_warm_task ()
+  {
+    {
+      lock_guard<mutex> guard (lock);
+      stopped = true;
+    }
+    wake.notify_all ();
+    client.stop ();
+    worker.join ();
+  }
+
+private:
+
+  Ollama client;
+  mutex lock;
+  condition_variable wake;
+  bool stopped = false;
+  thread worker;
+};
+
+// Keep warm threads, keyed by server URL and model name
+static map<pair<string, string>, unique_ptr<keep_warm_task>> keep_warm_tasks;
+
+// Cached health state of each server, so that a server is not probed with an
+// extra request on every call.  The server is probed again once its cached
+// state is older than health_ttl seconds or, in lazy mode, only after a
+// request to the server has failed.
+struct server_health
+{
+  chrono::steady_clock::time_point checked;
+  bool running = false;
+};
+
+static map<string, server_health> health_cache;
+static double health_ttl = 5;
+static bool health_lazy = false;
+
+static bool
+server_running (bool force)
+{
+  server_health& health = health_cache[ollama::getServerURL ()];
+  auto now = chrono::steady_clock::now ();
+  double age = chrono::duration<double> (now - health.checked).count ();
+  if (force || ! health.running || (! health_lazy && age >= health_ttl))
+  {
+    health.running = ollama::is_running ();
+    health.checked = now;
+  }
+  return health.running;
+}
+
+// Force a new probe on the next call after a failed request
+static void
+invalidate_server_health ()
+{
+  health_cache[ollama::getServerURL ()].running = false;
+}
+
+// Pool of interchangeable ollama servers.  Each request is routed to the
+// available server with the fewest requests in flight, where a server that
+// does not have the requested model loaded counts as having cold_penalty more
+// requests in flight, and ties are broken by the smallest average latency.  A
+// server that cannot be reached is skipped for down_time seconds.  The loaded
+// models of each server are refreshed from the calling thread, at most every
+// running_ttl seconds.
+struct endpoint
+{
+  string url;
+  int in_flight = 0;
+  double latency = 0;
+  chrono::steady_clock::time_point down_until;
+  chrono::steady_clock::time_point running_checked;
+  vector<string> running;
+};
+
+class endpoint_pool
+{
+public:
+
+  static constexpr int cold_penalty = 2;
+  static constexpr double down_time = 10;
+  static constexpr double running_ttl = 10;
+
+  // Set the servers of the pool, or disable the pool if there are none.  The
+  // state of each server is kept across calls, whichever pool it belongs to.
+  void configure (const vector<string>& urls)
+  {
+    lock_guard<mutex> guard (lock);
+    endpoints.clear ();
+    for (const auto& url : urls)
+    {
+      unique_ptr<endpoint>& e = known[url];
+      if (! e)
+      {
+        e.reset (new endpoint ());
+        e->url = url;
+      }
+      endpoints.push_back (e.get ());
+    }
+  }
+
+  bool active () const { return ! endpoints.empty (); }
+
+  size_t size () const { return endpoints.size (); }
+
+  const string& url (size_t idx) const { return endpoints[idx]->url; }
+
+  // Refresh the loaded models of the servers whose list is out of date
+  void refresh ()
+  {
+    auto now = chrono::steady_clock::now ();
+    for (size_t idx = 0; idx < endpoints.size (); idx++)
+    {
+      endpoint& e = *endpoints[idx];
+      if (now < e.down_until
+          || chrono::duration<double> (now - e.running_checked).count ()
+             < running_ttl)
+      {
+        continue;
+      }
+      vector<string> running;
+      bool reached = true;
+      try
+      {
+        Ollama probe (ollama::ollama);
+        probe.setServerURL (e.url);
+        probe.setConnectionTimeout (2);
+        probe.setReadTimeout (2);
+        running = probe.list_running_models ();
+      }
+      catch (exception& err)
+      {
+        reached = false;
+      }
+      lock_guard<mutex> guard (lock);
+      e.running_checked = now;
+      if (reached)
+      {
+        e.running = std::move (running);
+      }
+      else
+      {
+        e.down_until = now + chrono::duration_cast<chrono::steady_clock::duration>
+                             (chrono::duration<double> (down_time));
+      }
+    }
+  }
+
+  // Select the server for the next request without counting it as in flight
+  size_t select (const string& model)
+  {
+    lock_guard<mutex> guard (lock);
+    return best_endpoint (model);
+  }
+
+  // Select the server for the next request and count it as in flight
+  size_t acquire (const string& model)
+  {
+    lock_guard<mutex> guard (lock);
+    size_t idx = best_endpoint (model);
+    endpoints[idx]->in_flight++;
+    return idx;
+  }
+
+  // Count the given server as in flight
+  void hold (size_t idx)
+  {
+    lock_guard<mutex> guard (lock);
+    endpoints[idx]->in_flight++;
+  }
+
+  // Return the index of the server with the given URL, or size () if the URL
+  // does not belong to the pool
+  size_t find (const string& url) const
+  {
+    size_t idx = 0;
+    while (idx < endpoints.size () && endpoints[idx]->url != url)
+    {
+      idx++;
+    }
+    return idx;
+  }
+
+  // Record the end of a request, updating the average latency of a server
+  // that answered with the duration of the request in seconds (unless it is
+  // negative, as for a request that failed or was canceled) or taking a server
+  // that could not be reached out of the pool
+  void release (size_t idx, double seconds, bool unreachable)
+  {
+    lock_guard<mutex> guard (lock);
+    record (*endpoints[idx], seconds, unreachable);
+  }
+
+  // Release a request held on the server with the given URL, which remains
+  // valid when the pool is configured again before the request ends
+  void release (const string& url, double seconds, bool unreachable)
+  {
+    lock_guard<mutex> guard (lock);
+    record (*known[url], seconds, unreachable);
+  }
+
+  // Mark the server with the given URL as unreachable
+  void mark_down (const string& url)
+  {
+    lock_guard<mutex> guard (lock);
+    for (endpoint *e : endpoints)
+    {
+      if (e->url == url)
+      {
+        e->down_until = chrono::steady_clock::now ()
+                        + chrono::duration_cast<chrono::steady_clock::duration>
+                          (chrono::duration<double> (down_time));
+      }
+    }
+  }
+
+  octave_scalar_map status ()
+  {
+    lock_guard<mutex> guard (lock);
+    auto now = chrono::steady_clock::now ();
+    size_t n = endpoints.size ();
+    Cell urls (dim_vector (n, 1));
+    Cell running (dim_vector (n, 1));
+    NDArray in_flight (dim_vector (n, 1));
+    NDArray latency (dim_vector (n, 1));
+    boolNDArray available (dim_vector (n, 1));
+    for (size_t idx = 0; idx < n; idx++)
+    {
+      const endpoint& e = *endpoints[idx];
+      urls(idx) = e.url;
+      Cell models (dim_vector (e.running.size (), 1));
+      for (size_t m = 0; m < e.running.size (); m++)
+      {
+        models(m) = e.running[m];
+      }
+      running(idx) = models;
+      in_flight(idx) = e.in_flight;
+      latency(idx) = e.latency;
+      available(idx) = now >= e.down_until;
+    }
+    octave_scalar_map map;
+    map.assign ("url", urls);
+    map.assign ("available", available);
+    map.assign ("in_flight", in_flight);
+    map.assign ("latency", latency);
+    map.assign ("running", running);
+    return map;
+  }
+
+private:
+
+  // Return the index of the best server for the next request (with the lock
+  // held)
+  size_t best_endpoint (const string& model) const
+  {
+    auto now = chrono::steady_clock::now ();
+    size_t best = 0;
+    bool best_down = true;
+    int best_cost = 0;
+    for (size_t idx = 0; idx < endpoints.size (); idx++)
+    {
+      const endpoint& e = *endpoints[idx];
+      bool down = now < e.down_until;
+      bool loaded = false;
+      for (const auto& name : e.running)
+      {
+        loaded = loaded || name == model || name == model + ":latest";
+      }
+      int cost = e.in_flight + (loaded ? 0 : cold_penalty);
+      const endpoint& b = *endpoints[best];
+      if (idx == 0 || (best_down && ! down)
+          || (down == best_down
+              && (cost < best_cost
+                  || (cost == best_cost && e.latency < b.latency))))
+      {
+        best = idx;
+        best_down = down;
+        best_cost = cost;
+      }
+    }
+    return best;
+  }
+
+  // Record the end of a request on a server (with the lock held)
+  void record (endpoint& e, double seconds, bool unreachable)
+  {
+    e.in_flight--;
+    if (unreachable)
+    {
+      e.down_until = chrono::steady_clock::now ()
+                     + chrono::duration_cast<chrono::steady_clock::duration>
+                       (chrono::duration<double> (down_time));
+    }
+    else if (seconds >= 0)
+    {
+      e.latency = e.latency == 0 ? seconds : 0.8 * e.latency + 0.2 * seconds;
+    }
+  }
+
+  mutex lock;
+  map<string, unique_ptr<endpoint>> known;
+  vector<endpoint *> endpoints;
+};
+
+static endpoint_pool endpoints;
+
+// Asynchronous requests are declared after the server pool, so that they are
+// canceled before the pool is destroyed
+static map<octave_idx_type, unique_ptr<async_request>> async_requests;
+static octave_idx_type async_counter = 0;
+
+static async_request&
+get_async_request (const octave_value& id)
+{
+  if (! id.is_scalar_type () || ! id.isnumeric ())
+  {
+    error ("__ollama__: request handle must be a numeric scalar.");
+  }
+  auto it = async_requests.find (id.idx_type_value ());
+  if (it == async_requests.end ())
+  {
+    error ("__ollama__: invalid or expired request handle.");
+  }
+  return *(it->second);
+}
+
+// Send a request to the current server and, if it cannot be reached and a
+// server pool is used, send it again to the next selected server of the pool.
+// The server of the pool is counted as in flight while the request is sent,
+// and the duration of a successful request is recorded as its latency.
+template <typename F>
+static auto
+with_failover (const string& model, F send) -> decltype (send ())
+{
+  size_t idx = endpoints.find (ollama::getServerURL ());
+  if (idx == endpoints.size ())
+  {
+    return send ();
+  }
+  for (size_t attempt = 1; ; attempt++)
+  {
+    endpoints.hold (idx);
+    auto start = chrono::steady_clock::now ();
+    try
+    {
+      auto result = send ();
+      endpoints.release (idx, chrono::duration<double>
+                              (chrono::steady_clock::now () - start).count (),
+                         false);
+      return result;
+    }
+    catch (ollama::exception& err)
+    {
+      bool unreachable = connection_failed (err);
+      endpoints.release (idx, -1, unreachable);
+      if (! unreachable || attempt >= endpoints.size ())
+      {
+        throw;
+      }
+      invalidate_server_health ();
+      idx = endpoints.select (model);
+      ollama::setServerURL (endpoints.url (idx));
+    }
+    catch (...)
+    {
+      endpoints.release (idx, -1, false);
+      throw;
+    }
+  }
+}
+
+// Run the tasks 0 to n-1 over a bounded pool of worker threads.  Each worker
+// owns a persistent keep-alive connection to the server (or to each server of
+// the server pool) and picks the next pending task until all tasks are
+// exhausted.  Tasks must not throw, should return early once canceled is set,
+// and return false if the server could not be reached, in which case a task is
+// run again on another server of the pool.  While waiting, Octave remains
+// responsive to interrupts, in which case all connections are aborted and the
+// interrupt is rethrown once the workers have been joined.
+typedef function<bool (Ollama&, size_t, const atomic<bool>&)> pool_task;
+
+static void
+run_pool (size_t n, size_t concurrency, const string& model,
+          const pool_task& task)
+{
+  concurrency = min (max (concurrency, size_t (1)), n);
+  atomic<size_t> next {0};
+  atomic<size_t> completed {0};
+  atomic<bool> canceled {false};
+  size_t servers = endpoints.active () ? endpoints.size () : 1;
+  vector<unique_ptr<Ollama>> clients;
+  vector<thread> workers;
+  if (endpoints.active ())
+  {
+    endpoints.refresh ();
+  }
+  for (size_t c = 0; c < concurrency * servers; c++)
+  {
+    clients.emplace_back (new Ollama (ollama::ollama));
+    if (endpoints.active ())
+    {
+      clients.back ()->setServerURL (endpoints.url (c % servers));
+    }
+    clients.back ()->setKeepAlive (true);
+  }
+  for (size_t w = 0; w < concurrency; w++)
+  {
+    workers.emplace_back ([&, n, w] ()
+    {
+      for (size_t i = next++; i < n && ! canceled; i = next++)
+      {
+        for (size_t attempt = 1; ; attempt++)
+        {
+          if (! endpoints.active ())
+          {
+            task (*clients[w], i, canceled);
+            break;
+          }
+          size_t idx = endpoints.acquire (model);
+          auto start = chrono::steady_clock::now ();
+          bool reached = task (*clients[w * servers + idx], i, canceled);
+          endpoints.release (idx, chrono::duration<double>
+                                  (chrono::steady_clock::now () - start).count (),
+                             ! reached);
+          if (reached || canceled || attempt >= servers)
+          {
+            break;
+          }
+        }
+        completed++;
+      }
+    });
+  }
+  try
+  {
+    while (completed < n)
+    {
+      octave_quit ();
+      this_thread::sleep_for (chrono::milliseconds (20));
+    }
+  }
+  catch (...)
+  {
+    canceled = true;
+    for (auto& client : clients)
+    {
+      client->stop ();
+    }
+    for (auto& worker : workers)
+    {
+      worker.join ();
+    }
+    throw;
+  }
+  for (auto& worker : workers)
+  {
+    worker.join ();
+  }
+}
+
+// Run a batch of requests over a pool of worker threads.  Results are stored
+// in input order, with a per-item error flag (not a vector<bool>, whose
+// elements cannot be written concurrently).
+static void
+run_batch (const vector<ollama::request>& requests, size_t concurrency,
+           vector<string>& results, vector<char>& failed)
+{
+  results.assign (requests.size (), "");
+  failed.assign (requests.size (), false);
+  string model = requests.empty () ? "" : requests[0]["model"].get<string> ();
+  run_pool (requests.size (), concurrency, model,
+            [&] (Ollama& client, size_t i, const atomic<bool>&)
+  {
+    try
+    {
+      ollama::request request = requests[i];
+      ollama::response response = client.generate (request);
+      results[i] = response.as_json_string ();
+      failed[i] = false;
+    }
+    catch (exception& err)
+    {
+      results[i] = err.what ();
+      failed[i] = true;
+      return ! connection_failed (err);
+    }
+    return true;
+  });
+}
+
+// Split the inputs into chunks of at most max_items inputs and at most
+// max_chars characters in total.  A zero limit is ignored, and an input
+// longer than max_chars forms a chunk of its own.
+static vector<pair<size_t, size_t>>
+split_chunks (const vector<string>& input, size_t max_items, size_t max_chars)
+{
+  vector<pair<size_t, size_t>> chunks;
+  size_t begin = 0;
+  size_t chars = 0;
+  for (size_t i = 0; i < input.size (); i++)
+  {
+    size_t len = input[i].size ();
+    if ((max_items > 0 && i - begin >= max_items)
+        || (max_chars > 0 && i > begin && chars + len > max_chars))
+    {
+      chunks.emplace_back (begin, i);
+      begin = i;
+      chars = 0;
+    }
+    chars += len;
+  }
+  chunks.emplace_back (begin, input.size ());
+  return chunks;
+}
+
+// Request the embeddings of the inputs begin to end-1, retrying a failed
+// request up to retries times with an increasing delay.
+static ollama::response
+embed_chunk (Ollama& client, const string& model, const vector<string>& input,
+             size_t begin, size_t end, int dimensions,
+             const ollama::options& options, int retries,
+             const atomic<bool>& canceled)
+{
+  vector<string> chunk (input.begin () + begin, input.begin () + end);
+  ollama::request request = ollama::request::from_embedding (model, chunk, dimensions, options);
+  for (int attempt = 0; ; attempt++)
+  {
+    try
+    {
+      ollama::response response = client.generate_embeddings (request);
+      if (! response.as_json ().contains ("embeddings"))
+      {
+        throw ollama::exception ("no embeddings returned from server.");
+      }
+      return response;
+    }
+    catch (ollama::exception& err)
+    {
+      if (attempt >= retries || canceled)
+      {
+        throw;
+      }
+    }
+    this_thread::sleep_for (chrono::milliseconds (250 * (attempt + 1)));
+  }
+}
+
+// Copy all fields of a reply except for its embedding vectors
+static json
+strip_embeddings (const json& reply)
+{
+  json stripped = json::object ();
+  for (auto it = reply.begin (); it != reply.end (); ++it)
+  {
+    if (it.key () != "embeddings")
+    {
+      stripped[it.key ()] = it.value ();
+    }
+  }
+  return stripped;
+}
+
+// Generate the embeddings of a large input in chunks, which are sent
+// concurrently over a pool of connections.  Unless the dimension D of the
+// embeddings is requested, the chunks are first requested one by one until
+// one of them succeeds to learn D, so that every other chunk is written
+// straight into its rows of the preallocated NxD output.  The rows of any
+// chunk that still fails after all retries are left as NaN and their indices
+// are listed in the 'failed' field of the statistics.  Only if the server
+// cannot be reached, or if no chunk succeeds, is an error raised.
+template <typename A>
+static void
+embed_chunked (const string& model, const vector<string>& input,
+               int dimensions, const ollama::options& options,
+               const vector<pair<size_t, size_t>>& chunks,
+               size_t concurrency, int retries, octave_value_list& retval)
+{
+  typedef typename A::element_type T;
+  size_t n = input.size ();
+  vector<json> replies (chunks.size ());
+  vector<char> failed (chunks.size (), false);
+  size_t first = 0;
+  size_t d = dimensions;
+  ollama::response response;
+  if (dimensions <= 0)
+  {
+    atomic<bool> not_canceled {false};
+    for (; ; first++)
+    {
+      try
+      {
+        response = with_failover (model, [&] ()
+        {
+          return embed_chunk (ollama::ollama, model, input,
+                              chunks[first].first, chunks[first].second,
+                              dimensions, options, retries, not_canceled);
+        });
+        const json& embeddings = response.as_json ()["embeddings"];
+        if (! embeddings.empty () && embeddings.size ()
+                                     == chunks[first].second
+                                        - chunks[first].first)
+        {
+          d = embeddings[0].size ();
+          break;
+        }
+        if (first + 1 == chunks.size ())
+        {
+          throw ollama::exception ("no embeddings returned from server.");
+        }
+      }
+      catch (ollama::exception& err)
+      {
+        if (connection_failed (err) || first + 1 == chunks.size ())
+        {
+          throw;
+        }
+      }
+      failed[first] = true;
+    }
+  }
+  A vectors (dim_vector (n, d), numeric_limits<T>::quiet_NaN ());
+  T *data = vectors.fortran_vec ();
+  vector<size_t> pending;
+  for (size_t c = first; c < chunks.size (); c++)
+  {
+    if (dimensions > 0 || c > first)
+    {
+      pending.push_back (c);
+    }
+    else if (copy_rows (response.as_json ()["embeddings"], chunks[c].first,
+                        chunks[c].second, data, n, d))
+    {
+      replies[c] = strip_embeddings (response.as_json ());
+    }
+    else
+    {
+      failed[c] = true;
+    }
+  }
+  run_pool (pending.size (), concurrency, model,
+            [&] (Ollama& client, size_t i, const atomic<bool>& canceled)
+  {
+    size_t c = pending[i];
+    failed[c] = false;
+    try
+    {
+      ollama::response response = embed_chunk (client, model, input,
+                                                chunks[c].first,
+                                                chunks[c].second, dimensions,
+                                                options, retries, canceled);
+      const json& reply = response.as_json ();
+      if (copy_rows (reply["embeddings"], chunks[c].first, chunks[c].second,
+                     data, n, d))
+      {
+        replies[c] = strip_embeddings (reply);
+      }
+      else
+      {
+        failed[c] = true;
+      }
+    }
+    catch (exception& err)
+    {
+      failed[c] = true;
+      return ! connection_failed (err);
+    }
+    return true;
+  });
+  // Durations and token counts are summed over all chunks
+  json summary;
+  vector<double> failed_rows;
+  for (size_t c = 0; c < chunks.size (); c++)
+  {
+    if (failed[c])
+    {
+      for (size_t i = chunks[c].first; i < chunks[c].second; i++)
+      {
+        failed_rows.push_back (i + 1);
+      }
+      continue;
+    }
+    if (summary.is_null ())
+    {
+      summary = replies[c];
+      continue;
+    }
+    for (const char *key : {"total_duration", "load_duration",
+                            "prompt_eval_count"})
+    {
+      if (summary.contains (key) && replies[c].contains (key))
+      {
+        summary[key] = summary[key].get<double> ()
+                       + replies[c][key].get<double> ();
+      }
+    }
+  }
+  if (summary.is_null ())
+  {
+    throw ollama::exception ("no embeddings returned from server for any "
+                             "chunk of the input.");
+  }
+  NDArray failed_idx (dim_vector (1, failed_rows.size ()));
+  for (size_t i = 0; i < failed_rows.size (); i++)
+  {
+    failed_idx(i) = failed_rows[i];
+  }
+  retval(0) = vectors;
+  retval(1) = false;
+  if (retval.length () > 2)
+  {
+    octave_scalar_map stats = response_stats (summary);
+    stats.setfield ("chunks", double (chunks.size ()));
+    stats.setfield ("failed", failed_idx);
+    retval(2) = stats;
+  }
+}
+
+// Generate the embeddings of the input either with a single request or in
+// concurrent chunks, if it exceeds the chunk limits.
+static void
+embed_input (const string& model, const vector<string>& input, int dimensions,
+             const ollama::options& options, bool single_precision,
+             size_t chunk_size, size_t chunk_chars, size_t concurrency,
+             int retries, octave_value_list& retval)
+{
+  vector<pair<size_t, size_t>> chunks = split_chunks (input, chunk_size,
+                                                      chunk_chars);
+  if (chunks.size () > 1 && single_precision)
+  {
+    embed_chunked<FloatNDArray> (model, input, dimensions, options,
+                                 chunks, concurrency, retries, retval);
+  }
+  else if (chunks.size () > 1)
+  {
+    embed_chunked<NDArray> (model, input, dimensions, options,
+                            chunks, concurrency, retries, retval);
+  }
+  else
+  {
+    ollama::response response = with_failover (model, [&] ()
+    {
+      return ollama::generate_embeddings (model, input, dimensions, options);
+    });
+    embedding_output (response, single_precision, retval);
+  }
+}
+
+// 128-bit key of cached data, hashed with two FNV-1a passes of different
+// offset bases
+struct cache_key
+{
+  uint64_t lo;
+  uint64_t hi;
+  bool operator== (const cache_key& other) const
+  {
+    return lo == other.lo && hi == other.hi;
+  }
+};
+
+struct cache_key_hash
+{
+  size_t operator() (const cache_key& k) const
+  {
+    return k.lo;
+  }
+};
+
+static cache_key
+hash_key (const string& data)
+{
+  cache_key k = {14695981039346656037ULL, 9650029242287828579ULL};
+  for (unsigned char c : data)
+  {
+    k.lo = (k.lo ^ c) * 1099511628211ULL;
+    k.hi = (k.hi ^ c) * 1099511628211ULL;
+  }
+  return k;
+}
+
+// Content-addressed cache of embedding vectors.  Each vector is identified by
+// a 128-bit key hashed from the model name, the requested dimensions, and the
+// input text.  The vectors are persisted in a flat file, which starts with a
+// header holding the dimension D, followed by fixed-stride records of a key
+// and D single precision values in native byte order.  The file is memory
+// mapped, so that cached vectors are read back without any parsing, and new
+// vectors are appended to it.
+class embedding_cache
+{
+public:
+
+  typedef cache_key key;
+
+  embedding_cache (const string& path) : path (path)
+  {
+    load ();
+  }
+
+  static key make_key (const string& model, int dimensions, const string& text)
+  {
+    return hash_key (model + '\n' + to_string (dimensions) + '\n' + text);
+  }
+
+  size_t dimension () const
+  {
+    return dim;
+  }
+
+  // Return the cached vector of a key or nullptr if it is not cached
+  const float* find (const key& k) const
+  {
+    auto it = index.find (k);
+    if (it == index.end ())
+    {
+      return nullptr;
+    }
+    const char *record = file.data () + header_size + it->second * stride ();
+    return reinterpret_cast<const float*> (record + sizeof (key));
+  }
+
+  // Append the vectors of new keys, given in row-major order, to the file
+  void insert (const vector<key>& keys, const vector<float>& vectors, size_t d)
+  {
+    if (keys.empty ())
+    {
+      return;
+    }
+    if (dim != 0 && d != dim)
+    {
+      error ("__ollama__: embedding cache '%s' stores vectors of dimension %d.",
+             path.c_str (), static_cast<int> (dim));
+    }
+    // The mapping must be released before the file can be written to
+    file.close ();
+    ofstream out (path, ios::binary | ios::app);
+    if (dim == 0)
+    {
+      dim = d;
+      uint64_t header[4] = {magic, dim, 0, 0};
+      out.write (reinterpret_cast<const char*> (header), header_size);
+    }
+    for (size_t i = 0; i < keys.size (); i++)
+    {
+      out.write (reinterpret_cast<const char*> (&keys[i]), sizeof (key));
+      out.write (reinterpret_cast<const char*> (vectors.data () + i * dim),
+                 dim * sizeof (float));
+      index.emplace (keys[i], count + i);
+    }
+    out.close ();
+    if (! out)
+    {
+      error ("__ollama__: unable to write embedding cache '%s'.", path.c_str ());
+    }
+    count += keys.size ();
+    if (! file.open (path.c_str ()))
+    {
+      error ("__ollama__: unable to open embedding cache '%s'.", path.c_str ());
+    }
+  }
+
+private:
+
+  void load ()
+  {
+    if (! ifstream (path).good ())
+    {
+      return;
+    }
+    if (! file.open (path.c_str ()))
+    {
+      error ("__ollama__: unable to open embedding cache '%s'.", path.c_str ());
+    }
+    if (file.size () == 0)
+    {
+      return;
+    }
+    uint64_t header[4] = {0, 0, 0, 0};
+    if (file.size () >= header_size)
+    {
+      memcpy (header, file.data (), header_size);
+    }
+    if (header[0] != magic || header[1] == 0)
+    {
+      error ("__ollama__: '%s' is not a valid embedding cache.", path.c_str ());
+    }
+    dim = header[1];
+    // Ignore any incomplete record at the end of the file
+    count = (file.size () - header_size) / stride ();
+    for (size_t i = 0; i < count; i++)
+    {
+      key k;
+      memcpy (&k, file.data () + header_size + i * stride (), sizeof (key));
+      index.emplace (k, i);
+    }
+  }
+
+  size_t stride () const
+  {
+    return sizeof (key) + dim * sizeof (float);
+  }
+
+  static constexpr uint64_t magic = 0x31424d454d4c4c4fULL;  // "OLLMEMB1"
+  static constexpr size_t header_size = 4 * sizeof (uint64_t);
+  string path;
+  httplib::detail::mmap file {""};
+  unordered_map<key, size_t, cache_key_hash> index;
+  size_t dim = 0;
+  size_t count = 0;
+};
+
+static map<string, unique_ptr<embedding_cache>> embedding_caches;
+
+static embedding_cache&
+get_embedding_cache (const string& path)
+{
+  auto& cache = embedding_caches[path];
+  if (! cache)
+  {
+    cache.reset (new embedding_cache (path));
+  }
+  return *cache;
+}
+
+// Generate embeddings through the cache.  Only the inputs, which are not
+// cached yet, are sent to the server, and their vectors are added to the
+// cache.  Since the cache stores single precision values, the vectors of the
+// cache misses are also requested in single precision.
+template <typename A>
+static void
+embed_cached (embedding_cache& cache, const string& model,
+              const vector<string>& input, int dimensions,
+              const ollama::options& options, size_t chunk_size,
+              size_t chunk_chars, size_t concurrency, int retries,
+              octave_value_list& retval)
+{
+  typedef typename A::element_type T;
+  size_t n = input.size ();
+  // Look up every input, collecting each distinct cache miss once
+  vector<const float*> hits (n);
+  vector<size_t> miss_row (n);
+  vector<cache_key> miss_keys;
+  vector<string> miss_input;
+  unordered_map<cache_key, size_t, cache_key_hash> misses;
+  for (size_t i = 0; i < n; i++)
+  {
+    cache_key k = embedding_cache::make_key (model, dimensions,
+                                                        input[i]);
+    hits[i] = cache.find (k);
+    if (! hits[i])
+    {
+      auto it = misses.emplace (k, miss_input.size ()).first;
+      if (it->second == miss_input.size ())
+      {
+        miss_keys.push_back (k);
+        miss_input.push_back (input[i]);
+      }
+      miss_row[i] = it->second;
+    }
+  }
+  size_t m = miss_input.size ();
+  size_t d = cache.dimension ();
+  FloatNDArray miss_vectors;
+  octave_scalar_map stats;
+  if (m > 0)
+  {
+    octave_value_list miss_retval (3);
+    embed_input (model, miss_input, dimensions, options, true, chunk_size,
+                 chunk_chars, concurrency, retries, miss_retval);
+    if (miss_retval(1).bool_value ())
+    {
+      retval(0) = miss_retval(0);
+      retval(1) = true;
+      return;
+    }
+    miss_vectors = miss_retval(0).float_array_value ();
+    stats = miss_retval(2).scalar_map_value ();
+    d = miss_vectors.columns ();
+    if (cache.dimension () != 0 && d != cache.dimension ())
+    {
+      error ("__ollama__: embedding cache stores vectors of dimension %d.",
+             static_cast<int> (cache.dimension ()));
+    }
+  }
+  else
+  {
+    stats.setfield ("model", model);
+  }
+  // Assemble the output and store the new vectors (except for failed ones)
+  A vectors (dim_vector (n, d));
+  T *data = vectors.fortran_vec ();
+  const float *miss_data = miss_vectors.data ();
+  for (size_t i = 0; i < n; i++)
+  {
+    for (size_t j = 0; j < d; j++)
+    {
+      data[i+j*n] = hits[i] ? hits[i][j] : miss_data[miss_row[i]+j*m];
+    }
+  }
+  vector<cache_key> new_keys;
+  vector<float> new_vectors;
+  vector<char> failed (m, false);
+  for (size_t r = 0; r < m; r++)
+  {
+    if (d > 0 && miss_data[r] != miss_data[r])    // NaN rows failed
+    {
+      failed[r] = true;
+      continue;
+    }
+    new_keys.push_back (miss_keys[r]);
+    for (size_t j = 0; j < d; j++)
+    {
+      new_vectors.push_back (miss_data[r+j*m]);
+    }
+  }
+  cache.insert (new_keys, new_vectors, d);
+  // Report failed inputs by their index in the original input
+  if (stats.isfield ("failed"))
+  {
+    vector<double> failed_rows;
+    for (size_t i = 0; i < n; i++)
+    {
+      if (! hits[i] && failed[miss_row[i]])
+      {
+        failed_rows.push_back (i + 1);
+      }
+    }
+    NDArray failed_idx (dim_vector (1, failed_rows.size ()));
+    for (size_t i = 0; i < failed_rows.size (); i++)
+    {
+      failed_idx(i) = failed_rows[i];
+    }
+    stats.setfield ("failed", failed_idx);
+  }
+  stats.setfield ("cache_hits", double (n - count (hits.begin (), hits.end (), nullptr)));
+  stats.setfield ("cache_misses", double (m));
+  retval(0) = vectors;
+  retval(1) = false;
+  if (retval.length () > 2)
+  {
+    retval(2) = stats;
+  }
+}
+
+// Cache of generate and chat responses, keyed on the full request JSON, for
+// deterministic requests (e.g. with a fixed seed and zero temperature).  The
+// most recently used responses are kept in memory, and all responses may also
+// be stored as files in a directory, so that they persist across sessions.
+// Failing to write to the directory does not affect the request, and files
+// that cannot be parsed (e.g. left incomplete by an interrupted write) are
+// removed and treated as misses.
+class response_cache
+{
+public:
+
+  // Settings apply to the current call only, while cached responses remain.
+  // The memory tier keeps up to the number of entries of the last call that
+  // set a positive one, so that calls not using it leave it unchanged.
+  void configure (size_t max_entries, const string& dir)
+  {
+    capacity = max_entries;
+    directory = dir;
+    if (max_entries > 0)
+    {
+      limit = max_entries;
+      evict ();
+    }
+  }
+
+  bool enabled () const
+  {
+    return capacity > 0 || ! directory.empty ();
+  }
+
+  bool find (const cache_key& k, string& response)
+  {
+    auto it = index.find (k);
+    if (it != index.end ())
+    {
+      entries.splice (entries.begin (), entries, it->second);
+      response = it->second->second;
+      memory_hits++;
+      return true;
+    }
+    if (! directory.empty ())
+    {
+      const string name = filename (k);
+      ifstream in (name, ios::binary);
+      if (in)
+      {
+        response.assign (istreambuf_iterator<char> (in),
+                         istreambuf_iterator<char> ());
+        in.close ();
+        if (json::accept (response))
+        {
+          remember (k, response);
+          disk_hits++;
+          return true;
+        }
+        remove (name.c_str ());
+      }
+    }
+    misses++;
+    return false;
+  }
+
+  void insert (const cache_key& k, const string& response)
+  {
+    remember (k, response);
+    if (! directory.empty ())
+    {
+      // Write to a temporary file renamed into place once complete, so that
+      // readers never see a partial file
+      const string name = filename (k);
+      const string tmp = name + "."
+                         + to_string (chrono::system_clock::now ()
+                                      .time_since_epoch ().count ())
+                         + ".tmp";
+      ofstream out (tmp, ios::binary);
+      out << response;
+      out.close ();
+      if (! out || rename (tmp.c_str (), name.c_str ()) != 0)
+      {
+        remove (tmp.c_str ());
+      }
+    }
+  }
+
+  octave_scalar_map statistics () const
+  {
+    octave_scalar_map stats;
+    stats.setfield ("memory_hits", double (memory_hits));
+    stats.setfield ("disk_hits", double (disk_hits));
+    stats.setfield ("misses", double (misses));
+    stats.setfield ("entries", double (entries.size ()));
+    return stats;
+  }
+
+private:
+
+  void remember (const cache_key& k, const string& response)
+  {
+    if (capacity == 0 || index.count (k))
+    {
+      return;
+    }
+    entries.emplace_front (k, response);
+    index[k] = entries.begin ();
+    evict ();
+  }
+
+  void evict ()
+  {
+    while (entries.size () > limit)
+    {
+      index.erase (entries.back ().first);
+      entries.pop_back ();
+    }
+  }
+
+  string filename (const cache_key& k) const
+  {
+    char name[40];
+    snprintf (name, sizeof (name), "%016llx%016llx.json",
+              static_cast<unsigned long long> (k.hi),
+              static_cast<unsigned long long> (k.lo));
+    return directory + "/" + name;
+  }
+
+  size_t capacity = 0;
+  size_t limit = 0;
+  string directory;
+  list<pair<cache_key, string>> entries;
+  unordered_map<cache_key, list<pair<cache_key, string>>::iterator,
+                cache_key_hash> index;
+  size_t memory_hits = 0;
+  size_t disk_hits = 0;
+  size_t misses = 0;
+};
+
+static response_cache responses;
+
+// Send a generate or chat request through the response cache (if enabled).
+// A cached response is passed to the stream callback as a single token.
+static ollama::response
+send_cached (ollama::request& request, bool stream,
+             const function<bool (const ollama::response&)>& on_receive)
+{
+  bool is_chat = request.get_type () == ollama::message_type::chat;
+  cache_key k;
+  if (responses.enabled ())
+  {
+    // Hash the request body as it is sent, since dump () does not serialize
+    // the encoded tools of a chat request as JSON
+    string body, txt;
+    ollama::json_writer::write (request, [&body] (const char *data, size_t n)
+                                { body.append (data, n); return true; });
+    k = hash_key (body);
+    if (responses.find (k, txt))
+    {
+      ollama::response response (txt, request.get_type ());
+      if (stream)
+      {
+        on_receive (response);
+      }
+      return response;
+    }
+  }
+  // A streamed request is only sent again if no token has been received
+  bool received = false;
+  auto receive = [&] (const ollama::response& partial)
+  {
+    received = true;
+    return on_receive (partial);
+  };
+  string model = request["model"].get<string> ();
+  ollama::response response = with_failover (model, [&] ()
+  {
+    if (received)
+    {
+      throw ollama::exception ("Connection to server lost while streaming.");
+    }
+    if (stream)
+    {
+      return is_chat ? ollama::chat (request, receive)
+                     : ollama::generate (request, receive);
+    }
+    return is_chat ? ollama::chat (request) : ollama::generate (request);
+  });
+  if (responses.enabled ())
+  {
+    responses.insert (k, response.as_json_string ());
+  }
+  return response;
+}
+
+// Downscale a PNG image written by fpng, such as those returned by fig2base64,
+// so that its longest edge is at most max_size pixels.  The PNG is replaced by
+// the encoded smaller image and true is returned.  PNG images written by other
+// encoders are left unchanged, since fpng cannot decode them.
+static bool
+downscale_png (vector<unsigned char>& png, size_t max_size)
+{
+  static bool fpng_ready = false;
+  if (! fpng_ready)
+  {
+    fpng::fpng_init ();
+    fpng_ready = true;
+  }
+  vector<uint8_t> rgb;
+  uint32_t width, height, channels;
+  if (png.size () > numeric_limits<uint32_t>::max ()
+      || fpng::fpng_decode_memory (png.data (), png.size (), rgb, width,
+                                   height, channels, 3)
+         != fpng::FPNG_DECODE_SUCCESS)
+  {
+    return false;
+  }
+  vector<unsigned char> scaled;
+  size_t w, h;
+  vector<unsigned char> out;
+  if (! downscale_image (rgb.data (), width, height, 3, max_size, scaled, w, h)
+      || ! fpng::fpng_encode_image_to_memory (scaled.data (), w, h, 3, out))
+  {
+    return false;
+  }
+  png.swap (out);
+  return true;
+}
+
+static ollama::image
+encode_image (const vector<unsigned char>& bytes)
+{
+  string encoded (macaron::Base64::EncodedLength (bytes.size ()), '\0');
+  macaron::Base64::Encode (bytes.data (), bytes.size (), &encoded[0]);
+  return ollama::image (std::move (encoded));
+}
+
+// Number of leading bytes of a PNG written by fpng that hold its signature,
+// its IHDR chunk and the start of the fdEC chunk fpng writes right after it.
+static const size_t fpng_header_size = 41;
+
+// Return true if the first fpng_header_size bytes in header start a PNG
+// written by fpng whose longest edge is larger than max_size pixels, so that
+// downscale_png would replace it.
+static bool
+fpng_exceeds (const unsigned char *header, size_t max_size)
+{
+  static const unsigned char signature[] = {0x89, 'P', 'N', 'G',
+                                            '\r', '\n', 0x1a, '\n'};
+  if (memcmp (header, signature, sizeof (signature)) != 0
+      || memcmp (header + 12, "IHDR", 4) != 0
+      || memcmp (header + 37, "fdEC", 4) != 0)
+  {
+    return false;
+  }
+  auto be32 = [] (const unsigned char *p)
+  {
+    return (uint32_t (p[0]) << 24) | (uint32_t (p[1]) << 16)
+           | (uint32_t (p[2]) << 8) | uint32_t (p[3]);
+  };
+  return std::max (be32 (header + 16), be32 (header + 20)) > max_size;
+}
+
+// Load an image file, downscaling it to max_size as done by downscale_png if
+// max_size is nonzero.  Only the header is read before deciding, so files that
+// need no downscaling are loaded as they are.
+static ollama::image
+load_image (const string& filename, size_t max_size)
+{
+  if (max_size == 0)
+  {
+    return ollama::image::from_file (filename);
+  }
+  ifstream file (filename, ios::binary | ios::ate);
+  streamoff size = file ? streamoff (file.tellg ()) : streamoff (-1);
+  vector<unsigned char> bytes (fpng_header_size);
+  if (size < streamoff (fpng_header_size) || ! file.seekg (0)
+      || ! file.read (reinterpret_cast<char *> (bytes.data ()), bytes.size ())
+      || ! fpng_exceeds (bytes.data (), max_size))
+  {
+    return ollama::image::from_file (filename);
+  }
+  bytes.resize (size);
+  if (! file.read (reinterpret_cast<char *> (bytes.data ()) + fpng_header_size,
+                   size - fpng_header_size)
+      || ! downscale_png (bytes, max_size))
+  {
+    return ollama::image::from_file (filename);
+  }
+  return encode_image (bytes);
+}
+
+// Same as load_image for a base64 encoded image.
+static ollama::image
+load_base64_image (const string& base64, size_t max_size)
+{
+  // Base64 characters covering the fpng header.
+  const size_t header_chars = (fpng_header_size + 2) / 3 * 4;
+  if (max_size > 0 && base64.size () >= header_chars)
+  {
+    vector<unsigned char> bytes;
+    if (macaron::Base64::Decode (base64.substr (0, header_chars), bytes).empty ()
+        && bytes.size () >= fpng_header_size
+        && fpng_exceeds (bytes.data (), max_size)
+        && macaron::Base64::Decode (base64, bytes).empty ()
+        && downscale_png (bytes, max_size))
+    {
+      return encode_image (bytes);
+    }
+  }
+  return ollama::image::from_base64_string (base64);
+}
+
+// Append the messages built from the rows first to last-1 of a chat history
+// to messages, recording the number of messages after each row in row_end.
+// Images are downscaled to max_size as done by downscale_png.
+static void
+append_messages (const Cell& msg, octave_idx_type first, octave_idx_type last,
+                 ollama::messages& messages, vector<size_t>& row_end,
+                 size_t max_size)
+{
+  // Each row contains an input to the model, which can be user prompt or
+  // tool output, a single or multiple images, and the model's previous
+  // response, which can contain content, thinking, and tool calls.
+  //
+  // msg(m,0) -> character vector (cannot be empty) for user prompt or a
+  //             scalar cellstring with a tool's output in json format.
+  // msg(m,1) -> N-by-2 cellstr array (can be empty)
+  //             1st column specifies either "imageFile" or "imageBase64"
+  //             2nd column specifies the image itself
+  // msg(m,2) -> character vector (empty for m == 0) for model's content, a
+  //             2-by-1 cellstr array containing both content and thinking,
+  //             or a 3-by-1 array containing content (empty), thinking (if
+  //             enabled), and a list of tools in json that the model wants
+  //             to use.
+  for (octave_idx_type mrows = first; mrows < last; mrows++)
+  {
+    // Get input to model (either user prompt or tool output)
+    string user_prompt = "";
+    string tool_output = "";
+    string tool_name = "";
+    bool user_role = true;
+    if (msg(mrows,0).is_string ())
+    {
+      user_prompt = msg(mrows,0).string_value ();
+    }
+    else if (msg(mrows,0).iscellstr ())
+    {
+      Cell tool = msg(mrows,0).cell_value ();
+      for (octave_idx_type irows = 0; irows < tool.rows (); irows++)
+      {
+        tool_output = tool(irows, 0).string_value ();
+        tool_name = tool(irows, 1).string_value ();
+        ollama::message msg_tool("tool", tool_output, "", "", tool_name);
+        messages.push_back (msg_tool);
+      }
+      user_role = false;
+    }
+    else
+    {
+      error ("__ollama__: first column in 'message' contains invalid value.");
+    }
+    // Get any images
+    if (! msg(mrows,1).iscell () || msg(mrows,1).columns () != 2)
+    {
+      error ("__ollama__: second column in 'message' name must be a 2-column cell array.");
+    }
+    Cell img = msg(mrows,1).cell_value ();
+    vector<ollama::image> msg_images;
+    bool has_msg_images = false;
+    for (octave_idx_type irows = 0; irows < img.rows (); irows++)
+    {
+      if (img(irows,0).string_value () == "imageFile")
+      {
+        ollama::image image = load_image (img(irows,1).string_value (),
+                                          max_size);
+        msg_images.push_back (std::move (image));
+        has_msg_images = true;
+      }
+      else if (img(irows,0).string_value () == "imageBase64")
+      {
+        ollama::image image = load_base64_image (img(irows,1).string_value (),
+                                                 max_size);
+        msg_images.push_back (std::move (image));
+        has_msg_images = true;
+      }
+    }
+    // If input is a tool output, no images are allowed in the same request.
+    // Images are only valid for user prompt.
+    if (has_msg_images && ! user_role)
+    {
+      error ("__ollama__: cannot append images after a tool output in 'message'.");
+    }
+    // Create user prompt with images
+    if (has_msg_images)
+    {
+      ollama::message msg_with_images("user", user_prompt, msg_images);
+      messages.push_back (msg_with_images);
+    }
+    else // without any images
+    {
+      ollama::message msg_no_images("user", user_prompt);
+      messages.push_back (msg_no_images);
+    }
+    // Get content from previous response (if any)
+    string content = "";
+    string thinking = "";
+    string toolcall = "";
+    if (msg(mrows,2).is_string ())      // content only
+    {
+      content = msg(mrows,2).string_value ();
+    }
+    else if (msg(mrows,2).iscellstr ()) // content + thinking + toolcall
+    {
+      Cell response = msg(mrows,2).cell_value ();
+      content = response(0).string_value ();
+      thinking = response(1).string_value ();
+      toolcall = response(2).string_value ();
+    }
+    if (content.size () > 0 || toolcall.size () > 0)
+    {
+      ollama::message msg_prev_resp("assistant", content, thinking, toolcall, "");
+      messages.push_back (msg_prev_resp);
+    }
+    row_end.push_back (messages.size ());
+  }
+}
+
+// Chat session keeping the messages built from the rows of a chat history,
+// including any encoded images, so that each turn only marshals the rows that
+// have been appended since the previous turn.  The last row, whose response is
+// still pending, is marshalled again on the next turn.  A session also keeps
+// the context returned by generate requests, which is passed to the next
+// generate request so that the server does not evaluate the previous prompts
+// and responses again.
+struct chat_session
+{
+  ollama::messages messages;
+  // Number of messages after each complete row
+  vector<size_t> row_end;
+  // Fingerprint of each complete row, to find where a chat history differs
+  // from the one the messages were built from
+  vector<cache_key> row_hash;
+  // Context tokens returned by the last generate request
+  json context;
+  // Name/Value pairs stored by 'configureSession', which are prepended to the
+  // arguments of every call that uses the session
+  octave_value_list settings;
+  // Last generate or chat reply, which is only converted on request
+  json response;
+};
+
+static map<octave_idx_type, chat_session> chat_sessions;
+static octave_idx_type session_counter = 0;
+
+static chat_session&
+get_chat_session (const octave_value& id)
+{
+  if (! id.is_scalar_type () || ! id.isnumeric ())
+  {
+    error ("__ollama__: session handle must be a numeric scalar.");
+  }
+  auto it = chat_sessions.find (id.idx_type_value ());
+  if (it == chat_sessions.end ())
+  {
+    error ("__ollama__: invalid or closed session handle.");
+  }
+  return it->second;
+}
+
+// Prepend the settings stored in the session given with 'session' (if any) to
+// the arguments of a call, so that the arguments of the call override them
+static octave_value_list
+session_arguments (const octave_value_list& args)
+{
+  for (octave_idx_type p = 0; p + 1 < args.length (); p += 2)
+  {
+    if (args(p).is_string () && args(p).string_value () == "session")
+    {
+      const chat_session& session = get_chat_session (args(p+1));
+      if (session.settings.empty ())
+      {
+        break;
+      }
+      octave_value_list all = session.settings;
+      return all.append (args);
+    }
+  }
+  return args;
+}
+
+// Return the text fields of a reply, leaving its statistics in the session
+static octave_scalar_map
+reply_text (const json& reply)
+{
+  octave_scalar_map text;
+  if (reply.contains ("message"))
+  {
+    const json& message = reply["message"];
+    text.assign ("content", message.value ("content", ""));
+    text.assign ("thinking", message.value ("thinking", ""));
+    text.assign ("tool_calls", message.contains ("tool_calls")
+                               ? message["tool_calls"].dump () : "");
+  }
+  else
+  {
+    text.assign ("response", reply.value ("response", ""));
+    text.assign ("thinking", reply.value ("thinking", ""));
+  }
+  return text;
+}
+
+// Keep the reply of a request in its session and return either its text
+// fields or, unless lazy, the whole reply in JSON format
+static void
+session_reply (chat_session& session, json reply, bool lazy,
+               octave_value_list& retval)
+{
+  session.response = std::move (reply);
+  if (lazy)
+  {
+    retval(0) = reply_text (session.response);
+  }
+  else
+  {
+    retval(0) = session.response.dump ();
+  }
+}
+
+// Mix the text held by a value of a chat history, which is a character
+// vector or a cell array of them, into a fingerprint
+static void
+hash_value (cache_key& k, const octave_value& value)
+{
+  if (value.is_string ())
+  {
+    for (unsigned char c : value.string_value ())
+    {
+      k.lo = (k.lo ^ c) * 1099511628211ULL;
+      k.hi = (k.hi ^ c) * 1099511628211ULL;
+    }
+  }
+  else if (value.iscell ())
+  {
+    Cell items = value.cell_value ();
+    for (octave_idx_type i = 0; i < items.numel (); i++)
+    {
+      hash_value (k, items(i));
+    }
+  }
+  // Separate the values, so that moving text across them changes the result
+  k.lo = (k.lo ^ 0xff) * 1099511628211ULL;
+  k.hi = (k.hi ^ 0xff) * 1099511628211ULL;
+}
+
+// Fingerprint of a row of a chat history
+static cache_key
+row_hash (const Cell& msg, octave_idx_type row)
+{
+  cache_key k = hash_key ("");
+  for (octave_idx_type col = 0; col < msg.columns (); col++)
+  {
+    hash_value (k, msg(row,col));
+  }
+  return k;
+}
+
+// Update the session messages with the new rows of a chat history.  The
+// messages built from the rows where the chat history differs from the one
+// of the previous request in the session (if modified since) are dropped and
+// those rows are marshalled again.  The chat history must have at least one
+// row, the last one being the pending input to the model.
+static const ollama::messages&
+session_messages (chat_session& session, const Cell& msg, size_t max_size)
+{
+  size_t complete = msg.rows () - 1;
+  size_t kept = 0;
+  while (kept < session.row_hash.size () && kept < complete
+         && row_hash (msg, kept) == session.row_hash[kept])
+  {
+    kept++;
+  }
+  session.row_end.resize (kept);
+  session.row_hash.resize (kept);
+  // Drop the pending row of the previous turn and any modified rows
+  session.messages.resize (kept == 0 ? 0 : session.row_end.back ());
+  append_messages (msg, kept, complete, session.messages, session.row_end,
+                   max_size);
+  for (size_t row = kept; row < complete; row++)
+  {
+    session.row_hash.push_back (row_hash (msg, row));
+  }
+  vector<size_t> pending;
+  append_messages (msg, complete, msg.rows (), session.messages, pending,
+                   max_size);
+  return session.messages;
+}
+
+// Convert a parsed JSON value to an Octave value the same way as jsondecode
+// (with 'makeValidName' disabled) does for the values found in model
+// descriptions: objects become scalar structures, arrays of strings or of
+// mixed values become column cell arrays, numeric and logical arrays become
+// column vectors, and null becomes an empty array.
+static octave_value
+json_to_octave (const json& value)
+{
+  if (value.is_object ())
+  {
+    octave_scalar_map map;
+    for (auto it = value.begin (); it != value.end (); ++it)
+    {
+      map.assign (it.key (), json_to_octave (it.value ()));
+    }
+    return map;
+  }
+  if (value.is_array ())
+  {
+    bool numeric = ! value.empty ();
+    bool logical = ! value.empty ();
+    for (const auto& v : value)
+    {
+      numeric = numeric && v.is_number ();
+      logical = logical && v.is_boolean ();
+    }
+    octave_idx_type n = value.size ();
+    if (numeric)
+    {
+      NDArray array (dim_vector (n, 1));
+      for (octave_idx_type i = 0; i < n; i++)
+      {
+        array(i) = value[i].get<double> ();
+      }
+      return array;
+    }
+    if (logical)
+    {
+      boolNDArray array (dim_vector (n, 1));
+      for (octave_idx_type i = 0; i < n; i++)
+      {
+        array(i) = value[i].get<bool> ();
+      }
+      return array;
+    }
+    Cell cell (dim_vector (n, 1));
+    for (octave_idx_type i = 0; i < n; i++)
+    {
+      cell(i) = json_to_octave (value[i]);
+    }
+    return cell;
+  }
+  if (value.is_string ())
+  {
+    return octave_value (value.get<string> ());
+  }
+  if (value.is_boolean ())
+  {
+    return octave_value (value.get<bool> ());
+  }
+  if (value.is_number ())
+  {
+    return octave_value (value.get<double> ());
+  }
+  return octave_value (Matrix ());
+}
+
+// Description of each model returned by /api/show, keyed by server URL and
+// model name, so that checking the capabilities of a model takes a single
+// request per server.  Entries are dropped when the model is pulled, copied
+// over, or deleted, and when the list of models of the server shows that the
+// model was modified since it was described.
+static map<pair<string, string>, json> model_descriptions;
+
+// Modification time of each model available in each server, keyed by server
+// URL and model name, so that checking whether a model exists does not scan
+// the full list of models
+static unordered_map<string, unordered_map<string, string>> model_names;
+
+// Drop everything cached about a model on the current server, when it is
+// pulled, copied over, or deleted
+static void
+invalidate_model_cache (const string& model)
+{
+  model_descriptions.erase ({ollama::getServerURL (), model});
+  model_names.erase (ollama::getServerURL ());
+}
+
+// Store the models listed by /api/tags for the current server, dropping the
+// cached descriptions of the models that were modified or removed since
+static void
+cache_model_names (const json& list)
+{
+  const string& url = ollama::getServerURL ();
+  unordered_map<string, string>& names = model_names[url];
+  names.clear ();
+  for (const auto& m : list.value ("models", json::array ()))
+  {
+    names[m.value ("name", "")] = m.value ("modified_at", "");
+  }
+  auto it = model_descriptions.lower_bound ({url, ""});
+  while (it != model_descriptions.end () && it->first.first == url)
+  {
+    auto found = names.find (it->first.second);
+    if (found == names.end ()
+        || found->second != it->second.value ("modified_at", ""))
+    {
+      it = model_descriptions.erase (it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+// Convert the models listed by /api/tags or /api/ps into the columns of a
+// table, with the model name, family, format, parameter size, quantization
+// level and size of each model
+static octave_scalar_map
+model_table (const json& list)
+{
+  const json models = list.value ("models", json::array ());
+  size_t n = models.size ();
+  Cell model (dim_vector (n, 1));
+  Cell family (dim_vector (n, 1));
+  Cell format (dim_vector (n, 1));
+  Cell parameter (dim_vector (n, 1));
+  Cell quantization (dim_vector (n, 1));
+  NDArray size (dim_vector (n, 1));
+  for (size_t m = 0; m < n; m++)
+  {
+    const json& entry = models[m];
+    const json details = entry.value ("details", json::object ());
+    model(m) = entry.value ("model", entry.value ("name", ""));
+    family(m) = details.value ("family", "");
+    format(m) = details.value ("format", "");
+    parameter(m) = details.value ("parameter_size", "");
+    quantization(m) = details.value ("quantization_level", "");
+    size(m) = entry.value ("size", 0.0);
+  }
+  octave_scalar_map table;
+  table.assign ("model", model);
+  table.assign ("family", family);
+  table.assign ("format", format);
+  table.assign ("parameter", parameter);
+  table.assign ("quantization", quantization);
+  table.assign ("size", size);
+  return table;
+}
+
+// Check whether a model is available on the current server.  The list of
+// models is fetched once and fetched again only when the model is not found,
+// in case it was added to the server by another client.
+static bool
+model_exists (const string& model)
+{
+  auto it = model_names.find (ollama::getServerURL ());
+  if (it != model_names.end () && it->second.count (model))
+  {
+    return true;
+  }
+  cache_model_names (ollama::list_model_json ());
+  return model_names[ollama::getServerURL ()].count (model) > 0;
+}
+
+// Get the description of a model from the cache or from the server.  Errors
+// reported by the server, such as a missing model, are thrown.
+static const json&
+model_description (const string& model)
+{
+  pair<string, string> key (ollama::getServerURL (), model);
+  auto it = model_descriptions.find (key);
+  if (it != model_descriptions.end ())
+  {
+    return it->second;
+  }
+  json info = ollama::show_model_info (model);
+  if (info.contains ("error"))
+  {
+    throw ollama::exception (info["error"].is_string ()
+                             ? info["error"].get<string> ()
+                             : info["error"].dump ());
+  }
+  if (! info.is_object ())
+  {
+    throw ollama::exception ("Received bad response from Ollama server when querying model info.");
+  }
+  // Only keep what is needed for the capabilities, since the full description
+  // contains the model's template, license, and tokenizer data
+  json entry = json::object ();
+  for (const char *field : {"capabilities", "details", "modified_at"})
+  {
+    if (info.contains (field))
+    {
+      entry[field] = std::move (info[field]);
+    }
+  }
+  if (info.contains ("model_info") && info["model_info"].is_object ())
+  {
+    for (auto& item : info["model_info"].items ())
+    {
+      const string& name = item.key ();
+      if (name == "general.parameter_count"
+          || (name.size () > 15
+              && name.compare (name.size () - 15, 15, ".context_length") == 0)
+          || (name.size () > 20
+              && name.compare (name.size () - 20, 20, ".embedding_length") == 0))
+      {
+        entry["model_info"][name] = item.value ();
+      }
+    }
+  }
+  return model_descriptions[key] = std::move (entry);
+}
+
+// Build the capabilities structure of a model from its description
+static octave_scalar_map
+model_capabilities (const string& model, const json& info)
+{
+  octave_scalar_map caps;
+  caps.assign ("name", model);
+  json list = info.value ("capabilities", json::array ());
+  Cell names (dim_vector (list.size (), 1));
+  for (size_t i = 0; i < list.size (); i++)
+  {
+    names(i) = list[i].is_string () ? list[i].get<string> () : list[i].dump ();
+  }
+  caps.assign ("capabilities", names);
+  for (const char *flag : {"completion", "embedding", "thinking", "tools",
+                           "vision", "insert"})
+  {
+    bool has = find (list.begin (), list.end (), json (flag)) != list.end ();
+    caps.assign (flag, has);
+  }
+  // Sizes are read from the model info entries of the model's architecture
+  double parameters = 0;
+  double context = 0;
+  double embedding = 0;
+  if (info.contains ("model_info"))
+  {
+    for (auto& item : info["model_info"].items ())
+    {
+      if (! item.value ().is_number ())
+      {
+        continue;
+      }
+      const string& name = item.key ();
+      double val = item.value ().get<double> ();
+      if (name == "general.parameter_count")
+      {
+        parameters = val;
+      }
+      else if (name.find (".context_length") != string::npos)
+      {
+        context = val;
+      }
+      else if (name.find (".embedding_length") != string::npos)
+      {
+        embedding = val;
+      }
+    }
+  }
+  caps.assign ("parameter_count", parameters);
+  caps.assign ("context_length", context);
+  caps.assign ("embedding_length", embedding);
+  caps.assign ("details", json_to_octave (info.value ("details",
+                                                      json::object ())));
+  caps.assign ("modified_at", info.value ("modified_at", ""));
+  return caps;
+}
+
+// Pull a model while passing each status event to the progress callback, if
+// any, as a structure with status, digest, total, and completed fields.  The
+// pull is canceled if the callback returns false, and any error raised by the
+// callback (including an interrupt) is rethrown.  If the connection to the
+// server is lost, the pull is sent again after an increasing delay, since the
+// server resumes the download of partially downloaded layers.  Up to retries
+// consecutive attempts that do not receive any status event are made.
+static bool
+pull_model (const string& model, const octave_value& progress_fcn,
+            int retries)
+{
+  bool progressed = false;
+  auto on_progress = [&] (const json& event) -> bool
+  {
+    octave_quit ();
+    progressed = true;
+    if (progress_fcn.is_undefined ())
+    {
+      return true;
+    }
+    octave_scalar_map status;
+    status.assign ("status", event.value ("status", ""));
+    status.assign ("digest", event.value ("digest", ""));
+    status.assign ("total", event.value ("total", 0.0));
+    status.assign ("completed", event.value ("completed", 0.0));
+    octave_value_list out = octave::feval (progress_fcn, ovl (status), 0);
+    if (out.length () > 0 && out(0).is_bool_scalar () && ! out(0).bool_value ())
+    {
+      return false;
+    }
+    return true;
+  };
+  for (int attempt = 0; ; attempt++)
+  {
+    progressed = false;
+    try
+    {
+      return ollama::pull_model (model, on_progress);
+    }
+    catch (ollama::exception& err)
+    {
+      if (! connection_failed (err))
+      {
+        throw;
+      }
+      if (progressed)
+      {
+        attempt = 0;
+      }
+      if (attempt >= retries)
+      {
+        throw;
+      }
+    }
+    // Remain responsive to interrupts while waiting
+    for (int i = 0; i < 4 * (attempt + 1); i++)
+    {
+      octave_quit ();
+      this_thread::sleep_for (chrono::milliseconds (250));
+    }
+  }
+}
+
+// Type of the value of each model option accepted in the 'options' structure
+enum option_type
+{
+  option_int,
+  option_double,
+  option_bool
+};
+
+struct option_field
+{
+  const char *name;
+  option_type type;
+};
+
+static const option_field option_fields[] =
+{
+  {"num_keep", option_int},           {"presence_penalty", option_double},
+  {"seed", option_int},               {"frequency_penalty", option_double},
+  {"num_predict", option_int},        {"penalize_newline", option_bool},
+  {"top_k", option_int},              {"numa", option_bool},
+  {"top_p", option_double},           {"num_ctx", option_int},
+  {"min_p", option_double},           {"num_batch", option_int},
+  {"typical_p", option_double},       {"num_gpu", option_int},
+  {"repeat_last_n", option_int},      {"main_gpu", option_int},
+  {"temperature", option_double},     {"use_mmap", option_bool},
+  {"repeat_penalty", option_double},  {"num_thread", option_int}
+};
+
+// Marshal the fields of an 'options' structure into the model options.  Fields
+// that are not model options are ignored.
+static void
+marshal_options (const octave_scalar_map& opt, ollama::options& options)
+{
+  for (const option_field& field : option_fields)
+  {
+    octave_value val = opt.getfield (field.name);
+    if (val.is_undefined ())
+    {
+      continue;
+    }
+    switch (field.type)
+    {
+      case option_int:
+        options[field.name] = val.int_value ();
+        break;
+      case option_double:
+        options[field.name] = val.double_value ();
+        break;
+      case option_bool:
+        options[field.name] = val.bool_value ();
+        break;
+    }
+  }
+}
+
+// A request profile holds the validated settings that are shared by a series
+// of inference requests, so that each request only needs to pass its prompt or
+// messages along with the profile handle.
+struct request_profile
+{
+  string model;
+  ollama::options options;
+  string sysmsg;
+  string think;
+  string tools;
+};
+
+static map<octave_idx_type, request_profile> request_profiles;
+static octave_idx_type profile_counter = 0;
+
+static const request_profile&
+get_request_profile (const octave_value& id)
+{
+  if (! id.is_scalar_type () || ! id.isnumeric ())
+  {
+    error ("__ollama__: profile handle must be a numeric scalar.");
+  }
+  auto it = request_profiles.find (id.idx_type_value ());
+  if (it == request_profiles.end ())
+  {
+    error ("__ollama__: invalid or released profile handle.");
+  }
+  return it->second;
+}
+
+// Client-side phases of an inference call, measured with a steady clock: the
+// parsing of the input arguments, the marshalling of the chat history and the
+// images, the server health check, the connection, the sending of the request
+// body, the wait for the response headers, the receiving of the response body,
+// the parsing and marshalling of the response, and the whole call.  The HTTP
+// phases are zero when no request was sent from the calling thread, such as
+// for cached responses and for requests run by worker threads.
+static const char *timing_phases[] = {"parse", "marshal", "server", "connect",
+                                      "send", "wait", "receive", "output",
+                                      "total"};
+static constexpr size_t timing_phase_num = sizeof (timing_phases)
+                                           / sizeof (timing_phases[0]);
+
+struct call_timing
+{
+  string operation;
+  string model;
+  double phases[timing_phase_num];
+};
+
+// Ring buffer of the timings of the most recent inference calls
+static constexpr size_t timing_log_size = 256;
+static call_timing timing_log[timing_log_size];
+static size_t timing_log_count = 0;
+
+typedef chrono::steady_clock::time_point time_point;
+
+static double
+elapsed (const time_point& from, const time_point& to)
+{
+  if (from == time_point () || to == time_point () || to < from)
+  {
+    return 0;
+  }
+  return chrono::duration<double> (to - from).count ();
+}
+
+// Record the timing of an inference call in the ring buffer and return it as
+// a structure with the duration of each phase in seconds
+static octave_scalar_map
+record_timing (const string& operation, const string& model,
+               const time_point& start, const time_point& parsed,
+               const time_point& marshalled, const time_point& checked)
+{
+  time_point end = chrono::steady_clock::now ();
+  const ollama::request_timing& http = ollama::last_request_timing;
+  // Without a request from this thread, its phases are part of the output
+  time_point received = http.done == time_point () ? checked : http.done;
+  call_timing& t = timing_log[timing_log_count++ % timing_log_size];
+  t.operation = operation;
+  t.model = model;
+  double phases[timing_phase_num] =
+  {
+    elapsed (start, parsed),
+    elapsed (parsed, marshalled),
+    elapsed (marshalled, checked),
+    elapsed (http.start, http.connected),
+    elapsed (http.connected, http.sent),
+    elapsed (http.sent, http.headers),
+    elapsed (http.headers, http.done),
+    elapsed (received, end),
+    elapsed (start, end)
+  };
+  octave_scalar_map timing;
+  timing.assign ("operation", operation);
+  for (size_t i = 0; i < timing_phase_num; i++)
+  {
+    t.phases[i] = phases[i];
+    timing.assign (timing_phases[i], phases[i]);
+  }
+  return timing;
+}
+
+// Return the recorded timings, oldest first, as a structure of column vectors
+static octave_scalar_map
+timing_history ()
+{
+  size_t n = min (timing_log_count, timing_log_size);
+  size_t first = timing_log_count - n;
+  Cell operation (dim_vector (n, 1));
+  Cell model (dim_vector (n, 1));
+  vector<NDArray> phases (timing_phase_num, NDArray (dim_vector (n, 1)));
+  for (size_t i = 0; i < n; i++)
+  {
+    const call_timing& t = timing_log[(first + i) % timing_log_size];
+    operation(i) = t.operation;
+    model(i) = t.model;
+    for (size_t k = 0; k < timing_phase_num; k++)
+    {
+      phases[k](i) = t.phases[k];
+    }
+  }
+  octave_scalar_map history;
+  history.assign ("operation", operation);
+  history.assign ("model", model);
+  for (size_t k = 0; k < timing_phase_num; k++)
+  {
+    history.assign (timing_phases[k], phases[k]);
+  }
+  return history;
+}
+
+DEFUN_DLD (__ollama__, call_args, nargout,
            "-*- texinfo -*-\n\
- @deftypefn {llms} {[@var{txt}, @var{err}] =} __ollama__ (@var{Name}, @var{Value})\n\
+ @deftypefn  {llms} {[@var{txt}, @var{err}] =} __ollama__ (@var{Name}, @var{Value})\n\
+ @deftypefnx {llms} {[@var{txt}, @var{err}, @var{stats}] =} __ollama__ (@var{Name}, @var{Value})\n\
+ @deftypefnx {llms} {[@var{txt}, @var{err}, @var{stats}, @var{timing}] =} __ollama__ (@var{Name}, @var{Value})\n\
 \n\
 \n\
 Base fuction for ollama class. \n\
@@ -48,14 +2529,62 @@ are supported:\n\
 to be loaded is an embedding model.\n\
 @item @qcode{'prompt'} A character vector with the user's prompt.\n\
 @item @qcode{'serverURL'} A character vector with the server's URL.\n\
+@item @qcode{'serverPool'} A cell array of character vectors with the URLs of \
+interchangeable servers, among which inference requests are distributed.  \
+Each request is sent to the available server with the fewest requests in \
+flight, preferring servers that already have the model loaded and, among \
+equally loaded servers, the one with the smallest average latency.  A request \
+to a server that cannot be reached is sent again to another server of the \
+pool, and the unreachable server is skipped for 10 seconds.  Batched prompts \
+and chunked embeddings are spread over all servers of the pool.  When not \
+specified, requests are sent to @qcode{'serverURL'}.\n\
+@item @qcode{'healthCheck'} A nonnegative scalar specifying for how many \
+seconds the server's status is cached before it is probed again, or \
+@qcode{'lazy'} for probing the server only after a failed request.\n\
 @item @qcode{'readTimeout'} A double scalar for waiting response timeout.\n\
 @item @qcode{'writeTimeout'} A double scalar for waiting request timeout.\n\
+@item @qcode{'compression'} A character vector specifying whether the HTTP \
+transport is compressed.  With @qcode{'response'} (default), compressed \
+replies are accepted, and with @qcode{'all'}, request bodies of at least 4 KB \
+are also sent gzip compressed.  @qcode{'none'} disables compression.  The \
+ollama server itself neither compresses its replies nor accepts compressed \
+requests, so compression only takes effect behind a reverse proxy that \
+supports it, and only for the content codings that @qcode{__ollama__} was \
+built with, which are returned by @qcode{'Query'} with @qcode{'encodings'}.\n\
 @item @qcode{'Query'} A character vector for querying @qcode{'status'} or \
-@qcode{'version'} of the ollama server.\n\
+@qcode{'version'} of the ollama server, the @qcode{'cacheStats'} of the \
+response cache, the state of the servers in the last used server pool as \
+@qcode{'poolStatus'}, the client-side @qcode{'timings'} of the most recent \
+inference calls as a structure of column vectors, or the content codings that \
+compressed replies can be decoded from as @qcode{'encodings'}, which is empty \
+if @qcode{__ollama__} was built without zlib, brotli, and zstd.\n\
+@item @qcode{'keepAlive'} How long the server keeps the model loaded after a \
+request, either as a duration character vector such as @qcode{'5m'} or \
+@qcode{'1h30m'}, or as a real scalar in seconds, where a negative value keeps \
+the model loaded indefinitely and 0 unloads it right after the request.  By \
+default, it is @qcode{'5m'}.\n\
+@item @qcode{'keepWarm'} A logical scalar or a nonnegative scalar, which starts \
+or stops a background thread that loads the @qcode{'model'} again before its \
+@qcode{'keepAlive'} duration expires, so that the model is never unloaded \
+between requests.  A numeric value sets the interval in seconds between \
+consecutive loads, while @qcode{true} loads the model every 80% of its \
+@qcode{'keepAlive'} duration (or every 5 minutes, if the model is kept loaded \
+indefinitely).  Set @qcode{'embeddingModel'} for embedding models.  There is \
+a single thread per server and model.  \
+@var{txt} returns whether a thread is running.\n\
 @item @qcode{'loadModel'} A character vector with the name of the model to \
 be loaded in the server's memory.\n\
 @item @qcode{'pullModel'} A character vector with the name of the model to \
-be downloaded from the Ollama library.\n\
+be downloaded from the Ollama library.  The download status is streamed from \
+the server, so that @qcode{'readTimeout'} only limits the time between \
+consecutive status events.  If a @qcode{'stream'} function handle is given, it \
+is called with each status event as a structure with @qcode{status}, \
+@qcode{digest}, @qcode{total}, and @qcode{completed} fields, where the last \
+two are the total and downloaded bytes of the layer with the given digest, and \
+the pull is canceled if the function returns @qcode{false}.  If the connection \
+to the server is lost, the pull is sent again up to @qcode{'retries'} times \
+without any progress and the download resumes from the partially downloaded \
+layers kept by the server.\n\
 @item @qcode{'copyModel'} A 2-element cell array of character vectors with \
 source and target names of the model to be copied in the server.\n\
 @item @qcode{'deleteModel'} A character vector with the name of the model to \
@@ -63,18 +2592,40 @@ be deleted from the server.\n\
 @item @qcode{'unloadModel'} A character vector with the name of the model to \
 be unloaded from the server's memory.\n\
 @item @qcode{'modelInfo'} A character vector with the name of the model to \
-retrieve information for.\n\
+retrieve information for.  The model is first looked up in the list of \
+models available on the server, which is cached per server and refreshed when \
+the model is not found or after any model is pulled, copied, or deleted.\n\
+@item @qcode{'modelInfoDirect'} A logical scalar, which when @qcode{true} \
+skips the lookup of @qcode{'modelInfo'} in the list of available models and \
+queries the model information directly, returning the server's error if the \
+model does not exist.  By default, it is @qcode{false}.\n\
+@item @qcode{'modelCapabilities'} A character vector with the name of the \
+model whose capabilities are returned as a scalar structure with the fields \
+@qcode{name}, @qcode{capabilities} (a cell array of character vectors), the \
+logical flags @qcode{completion}, @qcode{embedding}, @qcode{thinking}, \
+@qcode{tools}, @qcode{vision}, and @qcode{insert}, the sizes \
+@qcode{parameter_count}, @qcode{context_length}, and @qcode{embedding_length} \
+(0 when unknown), the @qcode{details} structure, and @qcode{modified_at}. \
+The model description is cached per server, so that subsequent requests for \
+the same model do not contact the server.\n\
 @item @qcode{'listModels'} A character vector for returning the list of models \
-available in the server either as @qcode{'cellstr'} or in @qcode{'json'} \
-format.\n\
+available in the server either as @qcode{'cellstr'}, in @qcode{'json'} \
+format, or as a @qcode{'table'} structure with the @qcode{model}, \
+@qcode{family}, @qcode{format}, @qcode{parameter}, and @qcode{quantization} \
+cellstr columns and the numeric @qcode{size} column.\n\
 @item @qcode{'listRunningModels'} A character vector for returning the list of \
-modelsavailable in the server either as @qcode{'cellstr'} or in @qcode{'json'} \
-format.\n\
+modelsavailable in the server either as @qcode{'cellstr'}, in @qcode{'json'} \
+format, or as a @qcode{'table'} structure as for @qcode{'listModels'}.\n\
 @item @qcode{'imageFile'} A character vector or a cell array of character \
 vectors with the filename(s) of the image(s) to be included in a request.\n\
 @item @qcode{'imageBase64'} A character vector or a cell array of character \
 vectors with the base64 encoded string(s) of the image(s) to be included in a \
 request.\n\
+@item @qcode{'imageMaxSize'} A nonnegative integer scalar with the maximum \
+edge in pixels of the images included in a request.  Larger PNG images \
+written by fpng, such as those returned by @code{fig2base64}, are downscaled \
+before upload.  Other images are sent unchanged.  The default is 0, which \
+sends all images unchanged.\n\
 @item @qcode{'options'} A scalar structures whose fields with be included as \
 optional model parameters in a request.\n\
 @item @qcode{'message'} An @math{Nx3} cell array containing the message history \
@@ -84,16 +2635,114 @@ message for the model during a request.\n\
 @item @qcode{'think'} A character vector for setting the thinking mode of the \
 model during a request.\n\
 @item @qcode{'tools'} A character vector for sending a @qcode{toolFunction} or \
-a @qcode{toolRegistry} in JSON format to the mode during a request.\n\
+a @qcode{toolRegistry} in JSON format to the mode during a request.  The JSON \
+array is inserted into the request as is, without being parsed.\n\
 @item @qcode{'input'} A cell array of character vectors to generate embeddings \
 for.\n\
 @item @qcode{'dimensions'} An nonnegative integer scalar value specifying the \
 dimensions of the generated embeddings.\n\
+@item @qcode{'chunkSize'} A nonnegative integer scalar specifying the maximum \
+number of inputs sent in a single request when generating embeddings.  If the \
+@qcode{'input'} exceeds this limit, it is split into chunks, which are sent \
+over @qcode{'concurrency'} simultaneous connections.  By default, \
+@qcode{'chunkSize'} is 0, which disables this limit.\n\
+@item @qcode{'chunkChars'} A nonnegative integer scalar specifying the maximum \
+total number of characters sent in a single request when generating \
+embeddings.  By default, @qcode{'chunkChars'} is 0, which disables this limit.\n\
+@item @qcode{'retries'} A nonnegative integer scalar specifying how many times \
+a failed chunk of embeddings is requested again.  The rows of any chunk, which \
+still fails, are set to @qcode{NaN} and their indices are returned in the \
+@qcode{'failed'} field of @var{stats}.  When pulling a model, it specifies \
+how many times the pull is sent again after losing the connection without any \
+progress.  By default, @qcode{'retries'} is 2.\n\
+@item @qcode{'responseCache'} A nonnegative integer scalar specifying the \
+maximum number of generate and chat responses kept in memory for returning \
+them again, without contacting the server, for identical requests.  By \
+default, @qcode{'responseCache'} is 0, which disables the memory cache for \
+the call without dropping the responses kept by earlier calls.\n\
+@item @qcode{'responseCacheDir'} A character vector with the name of an \
+existing directory, in which generate and chat responses are stored as files \
+for returning them again for identical requests in later sessions.\n\
+@item @qcode{'embeddingCache'} A character vector with the filename of a \
+cache for embedding vectors, which is created if it does not exist.  Only the \
+inputs, whose embeddings are not found in the cache for the same model and \
+dimensions, are sent to the server and their embeddings are appended to the \
+cache, which stores them in single precision.  The number of cache hits and \
+misses is returned in the @qcode{'cache_hits'} and @qcode{'cache_misses'} \
+fields of @var{stats}.  The cache is ignored by asynchronous requests.\n\
+@item @qcode{'precision'} A character vector specifying whether the generated \
+embeddings are returned as @qcode{'double'} (default) or @qcode{'single'} \
+precision numeric arrays.\n\
+@item @qcode{'stream'} A function handle, which is called with each token of \
+the response as a character vector while the reply is being streamed from the \
+server.  Streaming is canceled if the function returns @qcode{false}.  When \
+pulling a model, the function is called with each download status event.\n\
+@item @qcode{'promptBatch'} A cell array of character vectors with the user's \
+prompts to be sent as independent requests.  The responses are returned in a \
+cell array of the same size along with a logical array of per-item error \
+flags.\n\
+@item @qcode{'concurrency'} A positive integer scalar specifying the number of \
+simultaneous connections used for sending a @qcode{'promptBatch'} or chunked \
+embeddings.\n\
+@item @qcode{'session'} A session handle for marshalling a @qcode{'message'} \
+history incrementally.  The messages built from the complete rows of the chat \
+history, including any images, are kept in the session, so that subsequent \
+chat requests only marshal the rows appended since the previous request, and \
+the rows modified since (if any).\n\
+When used with a @qcode{'prompt'}, the @qcode{'context'} returned by the \
+previous generate request in the same session is passed to the next one and it \
+is removed from the returned response.  The session is ignored by asynchronous \
+and batch requests.  The session also keeps the last generate or chat reply, \
+and any settings stored with @qcode{'configureSession'} are used as if they \
+were given before all other parameters of the call.\n\
+@item @qcode{'configureSession'} A session handle for storing all other \
+Name/Value pairs given along with it in the session, such as the \
+@qcode{'model'}, @qcode{'serverURL'}, @qcode{'options'}, and \
+@qcode{'systemMessage'}, so that subsequent calls with @qcode{'session'} only \
+need to pass their new data.  The stored settings replace any previously \
+stored ones and are validated, but no request is sent.\n\
+@item @qcode{'sessionContext'} A logical scalar specifying whether generate \
+requests with a @qcode{'session'} continue from the @qcode{'context'} of the \
+previous one.  By default, @qcode{'sessionContext'} is @qcode{true}.\n\
+@item @qcode{'lazyResponse'} A logical scalar, which when @qcode{true} makes \
+generate and chat requests with a @qcode{'session'} return a structure with \
+only the text of the reply in @var{txt}, instead of the whole reply in JSON \
+format.  For generate requests, it has the fields @qcode{response} and \
+@qcode{thinking}, and for chat requests, the fields @qcode{content}, \
+@qcode{thinking}, and @qcode{tool_calls}, which contains the tool calls in JSON \
+format or is empty.  The whole reply is kept in the session.\n\
+@item @qcode{'sessionResponse'} A session handle for returning the last \
+generate or chat reply kept in the session in JSON format.  @var{err} is \
+@qcode{true} if there is no reply yet.\n\
+@item @qcode{'compileProfile'} A logical scalar, which when @qcode{true} \
+stores the @qcode{'model'}, @qcode{'options'}, @qcode{'systemMessage'}, \
+@qcode{'think'}, and @qcode{'tools'} values given along with it as a request \
+profile and returns its handle in @var{txt}, without contacting the server.\n\
+@item @qcode{'profile'} The handle of a request profile, whose settings are \
+used for the request.  Any of the profile's settings specified after the \
+@qcode{'profile'} parameter override the stored ones.\n\
+@item @qcode{'releaseProfile'} The handle of a request profile to release.\n\
+@item @qcode{'newSession'} A logical scalar for creating a new session and \
+returning its handle.\n\
+@item @qcode{'closeSession'} A session handle for releasing the session.\n\
+@item @qcode{'async'} A logical scalar specifying whether the inference request \
+should run on a background thread.  If @qcode{true}, a numeric request handle \
+is returned immediately.\n\
+@item @qcode{'poll'} A request handle for returning a structure with the fields \
+@qcode{'done'}, which indicates whether the request has been completed, and \
+@qcode{'text'}, which contains the tokens streamed since the last poll.\n\
+@item @qcode{'wait'} A request handle for waiting until the request is completed \
+and returning its response.  The request handle is released afterwards.\n\
+@item @qcode{'cancel'} A request handle for canceling the request and releasing \
+the request handle.\n\
 @end itemize\n\
 \n\
 The following conditions apply:\n\n\
 @enumerate\n\
 @item Specifying @qcode{'Query'} ingores all other paramters.\n\
+@item Specifying @qcode{'poll'}, @qcode{'wait'}, @qcode{'cancel'}, \
+@qcode{'newSession'}, @qcode{'closeSession'}, or @qcode{'sessionResponse'} \
+ignores all other parameters.\n\
 @item You can only specify @qcode{'loadModel'}, @qcode{'pullModel'}, \
 @qcode{'copyModel'}, @qcode{'deleteModel'}, or @qcode{'unloadModel'} at once.\n\
 @item Specifying @qcode{'modelInfo'} takes precedence after any of the previous \
@@ -102,37 +2751,82 @@ parameters.\n\
 at once.  This only takes precedence after the @qcode{'modelInfo'} paramter.\n\
 @item You can either specify @qcode{'imageFile'} or @qcode{'imageBase64'} \
 at once.\n\
-@item You can either specify @qcode{'prompt'}, @qcode{'message'}, or \
-@qcode{'input'} at once.\n\
+@item You can either specify @qcode{'prompt'}, @qcode{'promptBatch'}, \
+@qcode{'message'}, or @qcode{'input'} at once.\n\
+@item When specifying @qcode{'input'}, the embeddings are returned in @var{txt} \
+as an @math{NxD} numeric array, where @math{N} is the number of inputs and \
+@math{D} is the dimension of the embeddings, and the remaining fields of the \
+response are returned in the structure @var{stats}.\n\
+@item For inference requests, @var{timing} returns a structure with the \
+client-side duration in seconds of each phase of the call: @qcode{parse}, \
+@qcode{marshal} (chat history and images), @qcode{server} (health check), \
+@qcode{connect}, @qcode{send}, @qcode{wait} (time to first byte), \
+@qcode{receive}, @qcode{output} (parsing and marshalling of the response), \
+and @qcode{total}.  The HTTP phases are zero when no request was sent from \
+the calling thread.  The timings of the last 256 inference calls are returned \
+by @qcode{'Query'} with @qcode{'timings'}.\n\
 @end enumerate\n\
 @end deftypefn")
 {
+  time_point t_start = chrono::steady_clock::now ();
   // Initialize output arguments
-  if (nargout != 2)
+  if (nargout < 2 || nargout > 4)
   {
-    error ("__ollama__: two output arguments are required.");
+    error ("__ollama__: two to four output arguments are required.");
   }
   octave_value_list retval (nargout);
-  // Check server is running
-  bool running = ollama::is_running ();
-  retval(1) = ! running;
+  for (int i = 2; i < nargout; i++)
+  {
+    retval(i) = octave_scalar_map ();
+  }
+  const octave_value_list args = session_arguments (call_args);
+  bool running = false;
   // Initialize variables for inference
   string tools = "NA";
   string model = "";
   string prompt = "";
   bool has_prompt = false;
+  vector<string> prompts;
+  bool has_promptBatch = false;
+  size_t concurrency = 1;
   string sysmsg = "";
   string think = "false";
   ollama::images images = ollama::images ();
+  vector<string> image_files;
+  vector<string> image_strings;
+  size_t image_max_size = 0;
   bool has_images = false;
   ollama::options options = ollama::options ();
   bool has_options = false;
   ollama::messages messages;
+  const ollama::messages *chat_messages = &messages;
+  Cell msg_cell;
   bool has_messages = false;
+  octave_value session_id;
+  bool has_session = false;
+  bool session_context = true;
+  bool lazy_response = false;
+  bool do_configureSession = false;
+  octave_value stream_fcn;
+  bool has_stream = false;
+  bool do_async = false;
+  bool do_compileProfile = false;
+  json keep_alive = "5m";
+  double keep_warm = 0;
+  bool do_keepWarm = false;
+  vector<string> server_pool;
   // Variables for generating embeddings
   vector<string> input;
   int dimensions = 0;
   bool has_input = false;
+  bool single_precision = false;
+  size_t chunk_size = 0;
+  size_t chunk_chars = 0;
+  int retries = 2;
+  string cache_file = "";
+  // Response cache settings
+  size_t cache_entries = 0;
+  string cache_dir = "";
   bool is_embeddingModel = false;
   // Initialize variables for handling models and server
   bool query_status = false;
@@ -146,9 +2840,12 @@ at once.\n\
   bool do_unloadModel = false;
   string modelInfoName = "";
   bool do_modelInfo = false;
+  bool modelInfoDirect = false;
+  bool do_modelCapabilities = false;
   bool do_listModels = false;
   bool do_listRunningModels = false;
   bool return_cellstr = false;
+  bool return_table = false;
 
   // Validate and parse inputs
   if (args.length () % 2 != 0)
@@ -165,7 +2862,8 @@ at once.\n\
     {
       error ("__ollama__: parameter name must be a character vector.");
     }
-    if (args(p).string_value () == "model")
+    const string name = args(p).string_value ();
+    if (name == "model")
     {
       if (! args(p+1).is_string ())
       {
@@ -173,7 +2871,7 @@ at once.\n\
       }
       model = args(p+1).string_value ();
     }
-    if (args(p).string_value () == "embeddingModel")
+    if (name == "embeddingModel")
     {
       if (! args(p+1).is_bool_scalar ())
       {
@@ -181,7 +2879,7 @@ at once.\n\
       }
       is_embeddingModel = args(p+1).bool_value ();
     }
-    else if (args(p).string_value () == "prompt")
+    else if (name == "prompt")
     {
       // Check for conflicting parameter
       if (has_messages)
@@ -196,22 +2894,84 @@ at once.\n\
       }
       prompt = args(p+1).string_value ();
     }
-    else if (args(p).string_value () == "serverURL")
+    else if (name == "promptBatch")
+    {
+      // Check parameter value
+      if (! args(p+1).iscellstr ())
+      {
+        error ("__ollama__: 'promptBatch' value must be a cell array of character vectors.");
+      }
+      Cell batch = args(p+1).cell_value ();
+      for (octave_idx_type b = 0; b < batch.numel (); b++)
+      {
+        prompts.push_back (batch(b).string_value ());
+      }
+      has_promptBatch = true;
+    }
+    else if (name == "concurrency")
+    {
+      // Check parameter value
+      if (! args(p+1).is_scalar_type () || ! args(p+1).isnumeric ())
+      {
+        error ("__ollama__: 'concurrency' value must be a numeric scalar.");
+      }
+      if (args(p+1).double_value () < 1 ||
+          args(p+1).double_value () != args(p+1).int_value ())
+      {
+        error ("__ollama__: 'concurrency' value must be a positive integer.");
+      }
+      concurrency = args(p+1).int_value ();
+    }
+    else if (name == "serverURL")
     {
       if (! args(p+1).is_string ())
       {
         error ("__ollama__: 'serverURL' value must be a character vector.");
       }
       ollama::setServerURL (args(p+1).string_value ());
-      running = ollama::is_running ();
-      if (! running)
+    }
+    else if (name == "serverPool")
+    {
+      if (! args(p+1).iscellstr ())
       {
-        retval(0) = running;
-        retval(1) = true; // flag for error
-        return retval;
+        error ("__ollama__: 'serverPool' value must be a cell array of character vectors.");
+      }
+      Cell urls = args(p+1).cell_value ();
+      server_pool.clear ();
+      for (octave_idx_type i = 0; i < urls.numel (); i++)
+      {
+        server_pool.push_back (urls(i).string_value ());
+      }
+    }
+    else if (name == "healthCheck")
+    {
+      // Can be either a TTL in seconds or 'lazy'
+      if (args(p+1).is_string () && args(p+1).string_value () == "lazy")
+      {
+        health_lazy = true;
+      }
+      else if (args(p+1).is_scalar_type () && args(p+1).isnumeric ()
+               && args(p+1).double_value () >= 0)
+      {
+        health_lazy = false;
+        health_ttl = args(p+1).double_value ();
+      }
+      else
+      {
+        error ("__ollama__: 'healthCheck' value must be a nonnegative scalar or 'lazy'.");
+      }
+    }
+    else if (name == "imageMaxSize")
+    {
+      if (! args(p+1).is_scalar_type () || ! args(p+1).isnumeric ()
+          || args(p+1).double_value () < 0
+          || args(p+1).double_value () != std::floor (args(p+1).double_value ()))
+      {
+        error ("__ollama__: 'imageMaxSize' value must be a nonnegative integer scalar.");
       }
+      image_max_size = args(p+1).double_value ();
     }
-    else if (args(p).string_value () == "readTimeout")
+    else if (name == "readTimeout")
     {
       if (! args(p+1).is_scalar_type () || ! args(p+1).is_double_type ())
       {
@@ -219,7 +2979,7 @@ at once.\n\
       }
       ollama::setReadTimeout (args(p+1).double_value ());
     }
-    else if (args(p).string_value () == "writeTimeout")
+    else if (name == "writeTimeout")
     {
       if (! args(p+1).is_scalar_type () || ! args(p+1).is_double_type ())
       {
@@ -227,7 +2987,17 @@ at once.\n\
       }
       ollama::setWriteTimeout (args(p+1).double_value ());
     }
-    else if (args(p).string_value () == "Query")
+    else if (name == "compression")
+    {
+      // Can be either 'none', 'response', or 'all'
+      string mode = args(p+1).is_string () ? args(p+1).string_value () : "";
+      if (mode != "none" && mode != "response" && mode != "all")
+      {
+        error ("__ollama__: 'compression' value must be 'none', 'response', or 'all'.");
+      }
+      ollama::setCompression (mode == "all", mode != "none");
+    }
+    else if (name == "Query")
     {
       // Can be either 'status' or 'version'
       if (! args(p+1).is_string ())
@@ -242,12 +3012,71 @@ at once.\n\
       {
         query_version = true;
       }
+      else if (args(p+1).string_value () == "cacheStats")
+      {
+        retval(0) = responses.statistics ();
+        retval(1) = false;
+        return retval;
+      }
+      else if (args(p+1).string_value () == "poolStatus")
+      {
+        retval(0) = endpoints.status ();
+        retval(1) = false;
+        return retval;
+      }
+      else if (args(p+1).string_value () == "timings")
+      {
+        retval(0) = timing_history ();
+        retval(1) = false;
+        return retval;
+      }
+      else if (args(p+1).string_value () == "encodings")
+      {
+        retval(0) = Ollama::accepted_encodings ();
+        retval(1) = false;
+        return retval;
+      }
       else
       {
         error ("__ollama__: invalid value for 'Query'.");
       }
     }
-    else if (args(p).string_value () == "loadModel")
+    else if (name == "keepAlive")
+    {
+      if (args(p+1).is_string ())
+      {
+        keep_alive = args(p+1).string_value ();
+      }
+      else if (args(p+1).is_real_scalar ())
+      {
+        keep_alive = args(p+1).double_value ();
+      }
+      else
+      {
+        error ("__ollama__: 'keepAlive' value must be a character vector or a real scalar.");
+      }
+      if (std::isnan (keep_alive_seconds (keep_alive)))
+      {
+        error ("__ollama__: invalid 'keepAlive' duration.");
+      }
+    }
+    else if (name == "keepWarm")
+    {
+      if (args(p+1).is_bool_scalar ())
+      {
+        keep_warm = args(p+1).bool_value () ? -1 : 0;
+      }
+      else if (args(p+1).is_real_scalar () && args(p+1).double_value () >= 0)
+      {
+        keep_warm = args(p+1).double_value ();
+      }
+      else
+      {
+        error ("__ollama__: 'keepWarm' value must be a logical or a nonnegative scalar.");
+      }
+      do_keepWarm = true;
+    }
+    else if (name == "loadModel")
     {
       if (! args(p+1).is_string ())
       {
@@ -260,7 +3089,7 @@ at once.\n\
       source = args(p+1).string_value ();
       do_loadModel = true;
     }
-    else if (args(p).string_value () == "pullModel")
+    else if (name == "pullModel")
     {
       if (! args(p+1).is_string ())
       {
@@ -273,7 +3102,7 @@ at once.\n\
       source = args(p+1).string_value ();
       do_pullModel = true;
     }
-    else if (args(p).string_value () == "copyModel")
+    else if (name == "copyModel")
     {
       if (! args(p+1).iscellstr () || args(p+1).cell_value ().numel () != 2)
       {
@@ -288,7 +3117,7 @@ at once.\n\
       target = fnames(1).string_value ();
       do_copyModel = true;
     }
-    else if (args(p).string_value () == "deleteModel")
+    else if (name == "deleteModel")
     {
       if (! args(p+1).is_string ())
       {
@@ -301,7 +3130,7 @@ at once.\n\
       source = args(p+1).string_value ();
       do_deleteModel = true;
     }
-    else if (args(p).string_value () == "unloadModel")
+    else if (name == "unloadModel")
     {
       if (! args(p+1).is_string ())
       {
@@ -314,7 +3143,7 @@ at once.\n\
       source = args(p+1).string_value ();
       do_unloadModel = true;
     }
-    else if (args(p).string_value () == "modelInfo")
+    else if (name == "modelInfo")
     {
       if (! args(p+1).is_string ())
       {
@@ -323,9 +3152,26 @@ at once.\n\
       modelInfoName = args(p+1).string_value ();
       do_modelInfo = true;
     }
-    else if (args(p).string_value () == "listModels")
+    else if (name == "modelInfoDirect")
+    {
+      if (! args(p+1).is_bool_scalar ())
+      {
+        error ("__ollama__: 'modelInfoDirect' value must be a logical scalar.");
+      }
+      modelInfoDirect = args(p+1).bool_value ();
+    }
+    else if (name == "modelCapabilities")
     {
-      // Can be either 'string' or 'json'
+      if (! args(p+1).is_string ())
+      {
+        error ("__ollama__: 'modelCapabilities' value must be a character vector.");
+      }
+      modelInfoName = args(p+1).string_value ();
+      do_modelCapabilities = true;
+    }
+    else if (name == "listModels")
+    {
+      // Can be either 'cellstr', 'json', or 'table'
       if (! args(p+1).is_string ())
       {
         error ("__ollama__: 'listModels' value must be a character vector.");
@@ -334,6 +3180,10 @@ at once.\n\
       {
         return_cellstr = true;
       }
+      else if (args(p+1).string_value () == "table")
+      {
+        return_table = true;
+      }
       else if (args(p+1).string_value () != "json")
       {
         error ("__ollama__: invalid value for 'listModels'.");
@@ -344,9 +3194,9 @@ at once.\n\
       }
       do_listModels = true;
     }
-    else if (args(p).string_value () == "listRunningModels")
+    else if (name == "listRunningModels")
     {
-      // Can be either 'string' or 'json'
+      // Can be either 'cellstr', 'json', or 'table'
       if (! args(p+1).is_string ())
       {
         error ("__ollama__: 'listRunningModels' name must be a character vector.");
@@ -355,6 +3205,10 @@ at once.\n\
       {
         return_cellstr = true;
       }
+      else if (args(p+1).string_value () == "table")
+      {
+        return_table = true;
+      }
       else if (args(p+1).string_value () != "json")
       {
         error ("__ollama__: invalid value for 'listRunningModels'.");
@@ -363,304 +3217,484 @@ at once.\n\
       {
         error ("__ollama__: specify either 'listModels' or 'listRunningModels'.");
       }
-      do_listRunningModels = true;
+      do_listRunningModels = true;
+    }
+    else if (name == "imageFile")
+    {
+      if (args(p+1).is_string ())
+      {
+        image_files = {args(p+1).string_value ()};
+      }
+      else if (args(p+1).iscellstr ())
+      {
+        Cell files = args(p+1).cell_value ();
+        for (octave_idx_type f = 0; f < files.numel (); f++)
+        {
+          image_files.push_back (files(f).string_value ());
+        }
+      }
+      else
+      {
+        error ("__ollama__: 'imageFile' name must be a character vector or a cell array of character vectors.");
+      }
+      if (has_images)
+      {
+        error ("__ollama__: specify either 'imageFile' or 'imageBase64'.");
+      }
+      has_images = true;
+    }
+    else if (name == "imageBase64")
+    {
+      if (args(p+1).is_string ())
+      {
+        image_strings = {args(p+1).string_value ()};
+      }
+      else if (args(p+1).iscellstr ())
+      {
+        Cell files = args(p+1).cell_value ();
+        for (octave_idx_type f = 0; f < files.numel (); f++)
+        {
+          image_strings.push_back (files(f).string_value ());
+        }
+      }
+      else
+      {
+        error ("__ollama__: 'imageBase64' name must be a character vector or a cell array of character vectors.");
+      }
+      if (has_images)
+      {
+        error ("__ollama__: specify either 'imageFile' or 'imageBase64'.");
+      }
+      has_images = true;
+    }
+    else if (name == "options")
+    {
+      // Must be a scalar structure
+      if (! args(p+1).isstruct ())
+      {
+        error ("__ollama__: 'options' value must be a scalar structure.");
+      }
+      marshal_options (args(p+1).scalar_map_value (), options);
+    }
+    else if (name == "message")
+    {
+      // Check for conflicting parameter
+      if (has_prompt)
+      {
+        error ("__ollama__: specify either 'prompt' or 'message'.");
+      }
+      has_messages = true;
+      // Check parameter value
+      if (! args(p+1).iscell ())
+      {
+        error ("__ollama__: 'message' name must be a cell array.");
+      }
+      // Get contents and size, which are marshalled after parsing
+      msg_cell = args(p+1).cell_value ();
+      if (msg_cell.columns () != 3)
+      {
+        error ("__ollama__: 'message' cell array must have 3 columns.");
+      }
+      if (msg_cell.rows () < 1)
+      {
+        error ("__ollama__: 'message' cell array cannot be empty.");
+      }
+    }
+    else if (name == "systemMessage")
+    {
+      // Check parameter value
+      if (! args(p+1).is_string ())
+      {
+        error ("__ollama__: 'systemMessage' must be a character vector.");
+      }
+      sysmsg = args(p+1).string_value ();
+      if (sysmsg == "default")
+      {
+        sysmsg = "";
+      }
+    }
+    else if (name == "think")
+    {
+      // Check parameter value
+      if (! args(p+1).is_string ())
+      {
+        error ("__ollama__: 'think' value must be a character vector.");
+      }
+      think = args(p+1).string_value ();
+    }
+    else if (name == "tools")
+    {
+      // Check parameter value
+      if (! args(p+1).is_string ())
+      {
+        error ("__ollama__: 'tools' value must be a character vector.");
+      }
+      tools = args(p+1).string_value ();
+    }
+    else if (name == "stream")
+    {
+      // Check parameter value
+      if (! args(p+1).is_function_handle ())
+      {
+        error ("__ollama__: 'stream' value must be a function handle.");
+      }
+      stream_fcn = args(p+1);
+      has_stream = true;
+    }
+    else if (name == "session")
+    {
+      get_chat_session (args(p+1));
+      session_id = args(p+1);
+      has_session = true;
+    }
+    else if (name == "configureSession")
+    {
+      get_chat_session (args(p+1));
+      session_id = args(p+1);
+      do_configureSession = true;
+    }
+    else if (name == "sessionContext"
+             || name == "lazyResponse")
+    {
+      // Check parameter value
+      if (! args(p+1).is_bool_scalar ())
+      {
+        error ("__ollama__: '%s' value must be a logical scalar.",
+               name.c_str ());
+      }
+      if (name == "sessionContext")
+      {
+        session_context = args(p+1).bool_value ();
+      }
+      else
+      {
+        lazy_response = args(p+1).bool_value ();
+      }
+    }
+    else if (name == "sessionResponse")
+    {
+      const chat_session& session = get_chat_session (args(p+1));
+      retval(0) = session.response.is_null () ? "" : session.response.dump ();
+      retval(1) = session.response.is_null ();
+      return retval;
+    }
+    else if (name == "compileProfile")
+    {
+      if (! args(p+1).is_bool_scalar ())
+      {
+        error ("__ollama__: 'compileProfile' value must be a logical scalar.");
+      }
+      do_compileProfile = args(p+1).bool_value ();
+    }
+    else if (name == "profile")
+    {
+      const request_profile& profile = get_request_profile (args(p+1));
+      model = profile.model;
+      options = profile.options;
+      sysmsg = profile.sysmsg;
+      think = profile.think;
+      tools = profile.tools;
+    }
+    else if (name == "releaseProfile")
+    {
+      if (! args(p+1).is_scalar_type () || ! args(p+1).isnumeric ())
+      {
+        error ("__ollama__: profile handle must be a numeric scalar.");
+      }
+      bool released = request_profiles.erase (args(p+1).idx_type_value ()) > 0;
+      retval(0) = released;
+      retval(1) = ! released;
+      return retval;
+    }
+    else if (name == "newSession")
+    {
+      chat_sessions[++session_counter] = chat_session ();
+      retval(0) = session_counter;
+      retval(1) = false;
+      return retval;
+    }
+    else if (name == "closeSession")
+    {
+      get_chat_session (args(p+1));
+      chat_sessions.erase (args(p+1).idx_type_value ());
+      retval(0) = true;
+      retval(1) = false;
+      return retval;
+    }
+    else if (name == "async")
+    {
+      // Check parameter value
+      if (! args(p+1).is_bool_scalar ())
+      {
+        error ("__ollama__: 'async' value must be a logical scalar.");
+      }
+      do_async = args(p+1).bool_value ();
     }
-    else if (args(p).string_value () == "imageFile")
+    else if (name == "poll")
     {
-      if (args(p+1).is_string ())
+      async_request& request = get_async_request (args(p+1));
+      octave_scalar_map status;
+      status.setfield ("done", request.done.load ());
+      status.setfield ("text", request.poll ());
+      retval(0) = status;
+      retval(1) = false;
+      return retval;
+    }
+    else if (name == "wait")
+    {
+      async_request& request = get_async_request (args(p+1));
+      // Remain responsive to interrupts while waiting
+      while (! request.done)
       {
-        ollama::image image = ollama::image::from_file (args(p+1).string_value ());
-        images = {image};
+        octave_quit ();
+        this_thread::sleep_for (chrono::milliseconds (20));
       }
-      else if (args(p+1).iscellstr ())
+      request.wait ();
+      if (request.type == ollama::message_type::embedding && ! request.failed)
       {
-        Cell files = args(p+1).cell_value ();
-        for (octave_idx_type f = 0; f < files.numel (); f++)
-        {
-          ollama::image image = ollama::image::from_file (files(f).string_value ());
-          images.push_back (image);
-        }
+        embedding_output (request.response, request.single_precision, retval);
       }
       else
       {
-        error ("__ollama__: 'imageFile' name must be a character vector or a cell array of character vectors.");
-      }
-      if (has_images)
-      {
-        error ("__ollama__: specify either 'imageFile' or 'imageBase64'.");
+        retval(0) = request.result;
+        retval(1) = request.failed;
       }
-      has_images = true;
+      async_requests.erase (args(p+1).idx_type_value ());
+      return retval;
     }
-    else if (args(p).string_value () == "imageBase64")
+    else if (name == "cancel")
     {
-      if (args(p+1).is_string ())
+      async_request& request = get_async_request (args(p+1));
+      request.cancel ();
+      async_requests.erase (args(p+1).idx_type_value ());
+      retval(0) = true;
+      retval(1) = false;
+      return retval;
+    }
+    else if (name == "input")
+    {
+      // Check parameter value
+      if (! args(p+1).iscellstr ())
       {
-        ollama::image image = ollama::image::from_base64_string (args(p+1).string_value ());
-        images = {image};
+        error ("__ollama__: 'input' value must be a cell array of character vectors.");
       }
-      else if (args(p+1).iscellstr ())
+      Cell inputs = args(p+1).cell_value ();
+      for (octave_idx_type ins = 0; ins < inputs.numel (); ins++)
       {
-        Cell files = args(p+1).cell_value ();
-        for (octave_idx_type f = 0; f < files.numel (); f++)
-        {
-          ollama::image image = ollama::image::from_base64_string (files(f).string_value ());
-          images.push_back (image);
-        }
+        string charvec = inputs(ins).string_value ();
+        input.push_back (charvec);
       }
-      else
+      has_input = true;
+    }
+    else if (name == "dimensions")
+    {
+      // Check parameter value
+      if (! args(p+1).is_scalar_type () || ! args(p+1).isnumeric ())
       {
-        error ("__ollama__: 'imageBase64' name must be a character vector or a cell array of character vectors.");
+        error ("__ollama__: 'dimensions' value must be a numeric scalar.");
       }
-      if (has_images)
+      if (args(p+1).int_value () < 0 || ! args(p+1).isinteger ())
       {
-        error ("__ollama__: specify either 'imageFile' or 'imageBase64'.");
+        error ("__ollama__: 'dimensions' value must be a nonnegative integer.");
       }
-      has_images = true;
+      dimensions = args(p+1).int_value ();
     }
-    else if (args(p).string_value () == "options")
+    else if (name == "chunkSize"
+             || name == "chunkChars"
+             || name == "retries")
     {
-      // Must be a scalar structure
-      if (! args(p+1).isstruct ())
+      // Check parameter value
+      if (! args(p+1).is_scalar_type () || ! args(p+1).isnumeric ()
+          || args(p+1).double_value () < 0
+          || args(p+1).double_value () != args(p+1).int_value ())
       {
-        error ("__ollama__: 'options' value must be a scalar structure.");
+        error ("__ollama__: '%s' value must be a nonnegative integer.",
+               name.c_str ());
       }
-      // Acceptable fields are:
-      // "num_keep"       -> integer       "presence_penalty"  -> double
-      // "seed"           -> integer       "frequency_penalty" -> double
-      // "num_predict"    -> integer       "penalize_newline"  -> logical
-      // "top_k"          -> integer       "numa"              -> logical
-      // "top_p"          -> double        "num_ctx"           -> integer
-      // "min_p"          -> double        "num_batch"         -> integer
-      // "typical_p"      -> double        "num_gpu"           -> integer
-      // "repeat_last_n"  -> integer       "main_gpu"          -> integer
-      // "temperature"    -> double        "use_mmap"          -> logical
-      // "repeat_penalty" -> double        "num_thread"        -> integer
-      octave_scalar_map opt = args(p+1).scalar_map_value ();
-      if (opt.isfield ("num_keep")) {
-        options["num_keep"] = opt.contents ("num_keep").int_value (); }
-      if (opt.isfield ("seed")) {
-        options["seed"] = opt.contents ("seed").int_value (); }
-      if (opt.isfield ("num_predict")) {
-        options["num_predict"] = opt.contents ("num_predict").int_value (); }
-      if (opt.isfield ("top_k")) {
-        options["top_k"] = opt.contents ("top_k").int_value (); }
-      if (opt.isfield ("top_p")) {
-        options["top_p"] = opt.contents ("top_p").double_value (); }
-      if (opt.isfield ("min_p")) {
-        options["min_p"] = opt.contents ("min_p").double_value (); }
-      if (opt.isfield ("typical_p")) {
-        options["typical_p"] = opt.contents ("typical_p").double_value (); }
-      if (opt.isfield ("repeat_last_n")) {
-        options["repeat_last_n"] = opt.contents ("repeat_last_n").int_value (); }
-      if (opt.isfield ("temperature")) {
-        options["temperature"] = opt.contents ("temperature").double_value (); }
-      if (opt.isfield ("repeat_penalty")) {
-        options["repeat_penalty"] = opt.contents ("repeat_penalty").double_value (); }
-      if (opt.isfield ("presence_penalty")) {
-        options["presence_penalty"] = opt.contents ("presence_penalty").double_value (); }
-      if (opt.isfield ("frequency_penalty")) {
-        options["frequency_penalty"] = opt.contents ("frequency_penalty").double_value (); }
-      if (opt.isfield ("penalize_newline")) {
-        options["penalize_newline"] = opt.contents ("penalize_newline").bool_value (); }
-      if (opt.isfield ("numa")) {
-        options["numa"] = opt.contents ("numa").bool_value (); }
-      if (opt.isfield ("num_ctx")) {
-        options["num_ctx"] = opt.contents ("num_ctx").int_value (); }
-      if (opt.isfield ("num_batch")) {
-        options["num_batch"] = opt.contents ("num_batch").int_value (); }
-      if (opt.isfield ("num_gpu")) {
-        options["num_gpu"] = opt.contents ("num_gpu").int_value (); }
-      if (opt.isfield ("main_gpu")) {
-        options["main_gpu"] = opt.contents ("main_gpu").int_value (); }
-      if (opt.isfield ("use_mmap")) {
-        options["use_mmap"] = opt.contents ("use_mmap").bool_value (); }
-      if (opt.isfield ("num_thread")) {
-        options["num_thread"] = opt.contents ("num_thread").int_value (); }
-    }
-    else if (args(p).string_value () == "message")
-    {
-      // Check for conflicting parameter
-      if (has_prompt)
+      if (name == "chunkSize")
       {
-        error ("__ollama__: specify either 'prompt' or 'message'.");
+        chunk_size = args(p+1).int_value ();
       }
-      has_messages = true;
-      // Check parameter value
-      if (! args(p+1).iscell ())
+      else if (name == "chunkChars")
       {
-        error ("__ollama__: 'message' name must be a cell array.");
+        chunk_chars = args(p+1).int_value ();
       }
-      // Get contents and size
-      Cell msg = args(p+1).cell_value ();
-      if (msg.columns () != 3)
+      else
       {
-        error ("__ollama__: 'message' cell array must have 3 columns.");
-      }
-      // Each row contains an input to the model, which can be user prompt or
-      // tool output, a single or multiple images, and the model's previous
-      // response, which can contain content, thinking, and tool calls.
-      //
-      // msg(m,0) -> character vector (cannot be empty) for user prompt or a
-      //             scalar cellstring with a tool's output in json format.
-      // msg(m,1) -> N-by-2 cellstr array (can be empty)
-      //             1st column specifies either "imageFile" or "imageBase64"
-      //             2nd column specifies the image itself
-      // msg(m,2) -> character vector (empty for m == 0) for model's content, a
-      //             2-by-1 cellstr array containing both content and thinking,
-      //             or a 3-by-1 array containing content (empty), thinking (if
-      //             enabled), and a list of tools in json that the model wants
-      //             to use.
-      for (octave_idx_type mrows = 0; mrows < msg.rows (); mrows++)
-      {
-        // Get input to model (either user prompt or tool output)
-        string user_prompt = "";
-        string tool_output = "";
-        string tool_name = "";
-        bool user_role = true;
-        if (msg(mrows,0).is_string ())
-        {
-          user_prompt = msg(mrows,0).string_value ();
-        }
-        else if (msg(mrows,0).iscellstr ())
-        {
-          Cell tool = msg(mrows,0).cell_value ();
-          for (octave_idx_type irows = 0; irows < tool.rows (); irows++)
-          {
-            tool_output = tool(irows, 0).string_value ();
-            tool_name = tool(irows, 1).string_value ();
-            ollama::message msg_tool("tool", tool_output, "", "", tool_name);
-            messages.push_back (msg_tool);
-          }
-          user_role = false;
-        }
-        else
-        {
-          error ("__ollama__: first column in 'message' contains invalid value.");
-        }
-        // Get any images
-        if (! msg(mrows,1).iscell () || msg(mrows,1).columns () != 2)
-        {
-          error ("__ollama__: second column in 'message' name must be a 2-column cell array.");
-        }
-        Cell img = msg(mrows,1).cell_value ();
-        vector<ollama::image> msg_images;
-        bool has_msg_images = false;
-        for (octave_idx_type irows = 0; irows < img.rows (); irows++)
-        {
-          if (img(irows,0).string_value () == "imageFile")
-          {
-            ollama::image image = ollama::image::from_file (img(irows,1).string_value ());
-            msg_images.push_back (image);
-            has_msg_images = true;
-          }
-          else if (img(irows,0).string_value () == "imageBase64")
-          {
-            ollama::image image = ollama::image::from_base64_string (img(irows,1).string_value ());
-            msg_images.push_back (image);
-            has_msg_images = true;
-          }
-        }
-        // If input is a tool output, no images are allowed in the same request.
-        // Images are only valid for user prompt.
-        if (has_msg_images && ! user_role)
-        {
-          error ("__ollama__: cannot append images after a tool output in 'message'.");
-        }
-        // Create user prompt with images
-        if (has_msg_images)
-        {
-          ollama::message msg_with_images("user", user_prompt, msg_images);
-          messages.push_back (msg_with_images);
-        }
-        else // without any images
-        {
-          ollama::message msg_no_images("user", user_prompt);
-          messages.push_back (msg_no_images);
-        }
-        // Get content from previous response (if any)
-        string content = "";
-        string thinking = "";
-        string toolcall = "";
-        if (msg(mrows,2).is_string ())      // content only
-        {
-          content = msg(mrows,2).string_value ();
-        }
-        else if (msg(mrows,2).iscellstr ()) // content + thinking + toolcall
-        {
-          Cell response = msg(mrows,2).cell_value ();
-          content = response(0).string_value ();
-          thinking = response(1).string_value ();
-          toolcall = response(2).string_value ();
-        }
-        if (content.size () > 0 || toolcall.size () > 0)
-        {
-          ollama::message msg_prev_resp("assistant", content, thinking, toolcall, "");
-          messages.push_back (msg_prev_resp);
-        }
+        retries = args(p+1).int_value ();
       }
     }
-    else if (args(p).string_value () == "systemMessage")
+    else if (name == "responseCache")
     {
       // Check parameter value
-      if (! args(p+1).is_string ())
-      {
-        error ("__ollama__: 'systemMessage' must be a character vector.");
-      }
-      sysmsg = args(p+1).string_value ();
-      if (sysmsg == "default")
+      if (! args(p+1).is_scalar_type () || ! args(p+1).isnumeric ()
+          || args(p+1).double_value () < 0
+          || args(p+1).double_value () != args(p+1).int_value ())
       {
-        sysmsg = "";
+        error ("__ollama__: 'responseCache' value must be a nonnegative integer.");
       }
+      cache_entries = args(p+1).int_value ();
     }
-    else if (args(p).string_value () == "think")
+    else if (name == "responseCacheDir")
     {
       // Check parameter value
       if (! args(p+1).is_string ())
       {
-        error ("__ollama__: 'think' value must be a character vector.");
+        error ("__ollama__: 'responseCacheDir' value must be a character vector.");
       }
-      think = args(p+1).string_value ();
+      cache_dir = args(p+1).string_value ();
     }
-    else if (args(p).string_value () == "tools")
+    else if (name == "embeddingCache")
     {
       // Check parameter value
       if (! args(p+1).is_string ())
       {
-        error ("__ollama__: 'tools' value must be a character vector.");
+        error ("__ollama__: 'embeddingCache' value must be a character vector.");
       }
-      tools = args(p+1).string_value ();
+      cache_file = args(p+1).string_value ();
     }
-    else if (args(p).string_value () == "input")
+    else if (name == "precision")
     {
-      // Check parameter value
-      if (! args(p+1).iscellstr ())
+      // Can be either 'double' or 'single'
+      if (! args(p+1).is_string ())
       {
-        error ("__ollama__: 'input' value must be a cell array of character vectors.");
+        error ("__ollama__: 'precision' value must be a character vector.");
       }
-      Cell inputs = args(p+1).cell_value ();
-      for (octave_idx_type ins = 0; ins < inputs.numel (); ins++)
+      if (args(p+1).string_value () == "single")
       {
-        string charvec = inputs(ins).string_value ();
-        input.push_back (charvec);
+        single_precision = true;
+      }
+      else if (args(p+1).string_value () == "double")
+      {
+        single_precision = false;
+      }
+      else
+      {
+        error ("__ollama__: invalid value for 'precision'.");
       }
-      has_input = true;
     }
-    else if (args(p).string_value () == "dimensions")
+  }
+
+  time_point t_parsed = chrono::steady_clock::now ();
+  ollama::set_model_keep_alive (keep_alive);
+
+  // Start or stop keeping a model loaded, which needs no server access
+  if (do_keepWarm)
+  {
+    if (model.empty ())
     {
-      // Check parameter value
-      if (! args(p+1).is_scalar_type () || ! args(p+1).isnumeric ())
+      error ("__ollama__: 'keepWarm' requires a 'model'.");
+    }
+    pair<string, string> key (ollama::getServerURL (), model);
+    keep_warm_tasks.erase (key);
+    double seconds = keep_alive_seconds (keep_alive);
+    if (keep_warm != 0 && seconds == 0)
+    {
+      error ("__ollama__: 'keepWarm' cannot be used with a zero 'keepAlive'.");
+    }
+    if (keep_warm < 0)
+    {
+      // Touch the model well before it expires, or every five minutes if it
+      // is kept loaded indefinitely, in case the server has been restarted
+      keep_warm = seconds < 0 ? 300 : max (1.0, 0.8 * seconds);
+    }
+    if (keep_warm > 0)
+    {
+      keep_warm_tasks[key].reset (new keep_warm_task (ollama::ollama, model,
+                                                      is_embeddingModel,
+                                                      keep_alive, keep_warm));
+    }
+    retval(0) = keep_warm > 0;
+    retval(1) = false;
+    return retval;
+  }
+
+  // Store the settings of a session, which are validated by parsing them but
+  // take effect in the calls that use the session
+  if (do_configureSession)
+  {
+    octave_value_list settings;
+    for (octave_idx_type p = 0; p < args.length (); p += 2)
+    {
+      string name = args(p).string_value ();
+      if (name != "configureSession" && name != "session")
       {
-        error ("__ollama__: 'dimensions' value must be a numeric scalar.");
+        settings.append (args(p));
+        settings.append (args(p+1));
       }
-      if (args(p+1).int_value () < 0 || ! args(p+1).isinteger ())
+    }
+    get_chat_session (session_id).settings = settings;
+    retval(0) = true;
+    retval(1) = false;
+    return retval;
+  }
+
+  // Store the settings of a request profile, which needs no server access
+  if (do_compileProfile)
+  {
+    if (model.empty ())
+    {
+      error ("__ollama__: 'compileProfile' requires a 'model'.");
+    }
+    request_profiles[++profile_counter] = {model, options, sysmsg, think,
+                                           tools};
+    retval(0) = profile_counter;
+    retval(1) = false;
+    return retval;
+  }
+
+  // Marshal the chat history
+  if (has_messages && has_session)
+  {
+    chat_messages = &session_messages (get_chat_session (session_id),
+                                       msg_cell, image_max_size);
+  }
+  else if (has_messages)
+  {
+    vector<size_t> row_end;
+    append_messages (msg_cell, 0, msg_cell.rows (), messages, row_end,
+                     image_max_size);
+  }
+
+  // Load the images, now that any size limit is known
+  for (const auto& file : image_files)
+  {
+    images.push_back (load_image (file, image_max_size));
+  }
+  for (const auto& base64 : image_strings)
+  {
+    images.push_back (load_base64_image (base64, image_max_size));
+  }
+
+  time_point t_marshalled = chrono::steady_clock::now ();
+
+  // Start communication with ollama server.  Inference requests are sent to
+  // the selected server of the server pool (if any), trying the next one if
+  // the selected server is not running.
+  endpoints.configure (server_pool);
+  bool inference = has_prompt || has_promptBatch || has_messages || has_input;
+  if (endpoints.active () && inference)
+  {
+    endpoints.refresh ();
+    for (size_t attempt = 1; ; attempt++)
+    {
+      size_t idx = endpoints.select (model);
+      ollama::setServerURL (endpoints.url (idx));
+      running = server_running (false);
+      if (running || attempt >= endpoints.size ())
       {
-        error ("__ollama__: 'dimensions' value must be a nonnegative integer.");
+        break;
       }
-      dimensions = args(p+1).int_value ();
+      endpoints.mark_down (endpoints.url (idx));
     }
   }
-
-  // Start communication with ollama server
+  // Check server is running (always probe when querying its status)
+  else
+  {
+    running = server_running (query_status);
+  }
+  time_point t_checked = chrono::steady_clock::now ();
+  ollama::last_request_timing = ollama::request_timing ();
   // Tasks without inference first
   if (! running)
   {
@@ -693,7 +3727,8 @@ at once.\n\
     bool model_pulled = false;
     try
     {
-      model_pulled = ollama::pull_model (source);
+      invalidate_model_cache (source);
+      model_pulled = pull_model (source, stream_fcn, retries);
       retval(0) = model_pulled;
       retval(1) = false;
     }
@@ -710,6 +3745,7 @@ at once.\n\
     bool model_copied = false;
     try
     {
+      invalidate_model_cache (target);
       model_copied = ollama::copy_model (source, target);
       retval(0) = model_copied;
       retval(1) = false;
@@ -727,6 +3763,7 @@ at once.\n\
     bool model_deleted = false;
     try
     {
+      invalidate_model_cache (source);
       model_deleted = ollama::delete_model (source);
       retval(0) = model_deleted;
       retval(1) = false;
@@ -746,21 +3783,42 @@ at once.\n\
     retval(1) = ! model_unloaded;
     return retval;
   }
+  if (do_modelCapabilities)
+  {
+    try
+    {
+      retval(0) = model_capabilities (modelInfoName,
+                                      model_description (modelInfoName));
+      retval(1) = false;
+    }
+    catch (ollama::exception& err)
+    {
+      string errmsg = err.what ();
+      retval(0) = errmsg;
+      retval(1) = true;
+    }
+    return retval;
+  }
   if (do_modelInfo)
   {
-    // Check first that model is available to avoid error
-    vector<string> models = ollama::list_models ();
     try
     {
-      for (int m = 0; m < models.size (); m++)
+      // Check first that model is available to avoid error, unless the server
+      // is queried directly, in which case its error is returned
+      if (! modelInfoDirect && ! model_exists (modelInfoName))
       {
-        if (models[m] == modelInfoName)
-        {
-          json m_info = ollama::show_model_info (modelInfoName);
-          retval(0) = m_info.dump ();
-          retval(1) = false;
-        }
+        throw ollama::exception ("model '" + modelInfoName
+                                 + "' is not available on the server.");
+      }
+      json m_info = ollama::show_model_info (modelInfoName);
+      if (m_info.contains ("error"))
+      {
+        throw ollama::exception (m_info["error"].is_string ()
+                                 ? m_info["error"].get<string> ()
+                                 : m_info["error"].dump ());
       }
+      retval(0) = m_info.dump ();
+      retval(1) = false;
     }
     catch (ollama::exception& err)
     {
@@ -774,9 +3832,15 @@ at once.\n\
   {
     try
     {
+      json json_models = ollama::list_model_json ();
+      cache_model_names (json_models);
       if (return_cellstr)
       {
-        vector<string> models = ollama::list_models ();
+        vector<string> models;
+        for (auto& model : json_models["models"])
+        {
+          models.push_back (model["name"]);
+        }
         size_t model_num = models.size ();
         Cell model_names (model_num, 1);
         for (int m = 0; m < model_num; m++)
@@ -786,9 +3850,13 @@ at once.\n\
         retval(0) = model_names;
         retval(1) = false;
       }
+      else if (return_table)
+      {
+        retval(0) = model_table (json_models);
+        retval(1) = false;
+      }
       else
       {
-        json json_models = ollama::list_model_json ();
         string models = json_models.dump ();
         retval(0) = models;
         retval(1) = false;
@@ -818,6 +3886,11 @@ at once.\n\
         retval(0) = model_names;
         retval(1) = false;
       }
+      else if (return_table)
+      {
+        retval(0) = model_table (ollama::running_model_json ());
+        retval(1) = false;
+      }
       else
       {
         json json_models = ollama::running_model_json ();
@@ -840,22 +3913,145 @@ at once.\n\
   {
     error ("__ollama: 'model' parameter is required.");
   }
-  if (! has_prompt && ! has_messages && ! has_input)
+  if (! has_prompt && ! has_promptBatch && ! has_messages && ! has_input)
   {
     error ("__ollama: 'prompt', 'message', or 'input' parameter is required for inference.");
   }
+  if (has_promptBatch)
+  {
+    if (do_async || has_stream)
+    {
+      error ("__ollama__: 'promptBatch' cannot be streamed or run asynchronously.");
+    }
+    vector<ollama::request> requests;
+    for (const auto& batch_prompt : prompts)
+    {
+      requests.emplace_back (model, batch_prompt, think, sysmsg, options, images);
+    }
+    vector<string> results;
+    vector<char> failed;
+    run_batch (requests, concurrency, results, failed);
+    if (find (failed.begin (), failed.end (), true) != failed.end ())
+    {
+      invalidate_server_health ();
+    }
+    Cell txt (dim_vector (prompts.size (), 1));
+    boolNDArray err (dim_vector (prompts.size (), 1));
+    for (size_t i = 0; i < prompts.size (); i++)
+    {
+      txt(i) = results[i];
+      err(i) = failed[i];
+    }
+    retval(0) = txt;
+    retval(1) = err;
+    octave_scalar_map timing = record_timing ("promptBatch", model, t_start,
+                                              t_parsed, t_marshalled,
+                                              t_checked);
+    if (nargout > 3)
+    {
+      retval(3) = timing;
+    }
+    return retval;
+  }
+  if (do_async)
+  {
+    if (has_stream)
+    {
+      error ("__ollama__: 'stream' cannot be used with asynchronous requests.");
+    }
+    if (chunk_size > 0 || chunk_chars > 0)
+    {
+      error ("__ollama__: chunked embeddings cannot be run asynchronously.");
+    }
+    unique_ptr<async_request> request (new async_request (ollama::ollama));
+    // Count the selected server of the pool as in flight until the request ends
+    size_t idx = endpoints.find (ollama::getServerURL ());
+    if (idx < endpoints.size ())
+    {
+      endpoints.hold (idx);
+      string url = endpoints.url (idx);
+      request->finished = [url] (double seconds, bool unreachable)
+      {
+        endpoints.release (url, seconds, unreachable);
+      };
+    }
+    if (has_prompt)
+    {
+      request->start (ollama::request (model, prompt, think, sysmsg, options, images));
+    }
+    else if (has_messages)
+    {
+      request->start (ollama::request (model, *chat_messages, think, sysmsg, tools, options));
+    }
+    else
+    {
+      request->single_precision = single_precision;
+      request->start (ollama::request::from_embedding (model, input, dimensions, options));
+    }
+    async_requests[++async_counter] = std::move (request);
+    retval(0) = async_counter;
+    retval(1) = false;
+    return retval;
+  }
+  // Pass each streamed token to the callback function.  Any error raised by
+  // the callback function (including an interrupt) cancels the streaming and
+  // is rethrown once the connection has been closed.
+  auto stream_callback = [&stream_fcn] (const ollama::response& partial) -> bool
+  {
+    octave_quit ();
+    string token = partial.as_simple_string ();
+    if (token.empty ())
+    {
+      return true;
+    }
+    octave_value_list out = octave::feval (stream_fcn, ovl (token), 0);
+    if (out.length () > 0 && out(0).is_bool_scalar () && ! out(0).bool_value ())
+    {
+      return false;
+    }
+    return true;
+  };
+  responses.configure (cache_entries, cache_dir);
   if (has_prompt)         // use generate
   {
     try
     {
-      ollama::response response;
-      response = ollama::generate (model, prompt, think, sysmsg, options, images);
-      string txt = response.as_json_string ();
-      retval(0) = txt;
+      ollama::request request (model, prompt, think, sysmsg, options, images);
+      if (has_session)
+      {
+        // Continue from the context of the previous generate request
+        chat_session& session = get_chat_session (session_id);
+        if (! session_context)
+        {
+          session.context = json ();
+        }
+        if (! session.context.is_null ())
+        {
+          request["context"] = session.context;
+        }
+        ollama::response response = send_cached (request, has_stream,
+                                                 stream_callback);
+        json reply = response.as_json ();
+        if (reply.contains ("context"))
+        {
+          if (session_context)
+          {
+            session.context = std::move (reply["context"]);
+          }
+          reply.erase ("context");
+        }
+        session_reply (session, std::move (reply), lazy_response, retval);
+      }
+      else
+      {
+        retval(0) = send_cached (request, has_stream,
+                                 stream_callback).as_json_string ();
+      }
       retval(1) = false;
     }
     catch (ollama::exception& err)
     {
+      invalidate_server_health ();
       string errmsg = err.what ();
       retval(0) = errmsg;
       retval(1) = true;
@@ -865,14 +4061,23 @@ at once.\n\
   {
     try
     {
-      ollama::response response;
-      response = ollama::chat (model, messages, think, sysmsg, tools, options);
-      string txt = response.as_json_string ();
-      retval(0) = txt;
+      ollama::request request (model, *chat_messages, think, sysmsg, tools, options);
+      ollama::response response = send_cached (request, has_stream,
+                                               stream_callback);
+      if (has_session)
+      {
+        session_reply (get_chat_session (session_id), response.as_json (),
+                       lazy_response, retval);
+      }
+      else
+      {
+        retval(0) = response.as_json_string ();
+      }
       retval(1) = false;
     }
     catch (ollama::exception& err)
     {
+      invalidate_server_health ();
       string errmsg = err.what ();
       retval(0) = errmsg;
       retval(1) = true;
@@ -882,18 +4087,39 @@ at once.\n\
   {
     try
     {
-      ollama::response response;
-      response = ollama::generate_embeddings (model, input, dimensions, options);
-      string txt = response.as_json_string ();
-      retval(0) = txt;
-      retval(1) = false;
+      if (cache_file.empty ())
+      {
+        embed_input (model, input, dimensions, options, single_precision,
+                     chunk_size, chunk_chars, concurrency, retries, retval);
+      }
+      else if (single_precision)
+      {
+        embed_cached<FloatNDArray> (get_embedding_cache (cache_file), model,
+                                    input, dimensions, options, chunk_size,
+                                    chunk_chars, concurrency, retries, retval);
+      }
+      else
+      {
+        embed_cached<NDArray> (get_embedding_cache (cache_file), model,
+                               input, dimensions, options, chunk_size,
+                               chunk_chars, concurrency, retries, retval);
+      }
     }
     catch (ollama::exception& err)
     {
+      invalidate_server_health ();
       string errmsg = err.what ();
       retval(0) = errmsg;
       retval(1) = true;
     }
   }
+  octave_scalar_map timing = record_timing (has_prompt ? "generate"
+                                            : (has_messages ? "chat" : "embed"),
+                                            model, t_start, t_parsed,
+                                            t_marshalled, t_checked);
+  if (nargout > 3)
+  {
+    retval(3) = timing;
+  }
   return retval;
 }
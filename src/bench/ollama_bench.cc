@@ -0,0 +1,378 @@
+/*
+Copyright (C) 2025-2026 Andreas Bertsatos <abertsatos@biol.uoa.gr>
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmark of the client hot paths against an in-process mock of the ollama
+// server.  The mock answers /api/generate, /api/chat, and /api/embed after a
+// configurable latency with responses of a configurable size, so that the
+// measured times are dominated by the client: building and sending requests,
+// and receiving and parsing responses.  The figure benchmark runs the native
+// part of fig2base64 (repacking, PNG encoding and base64 encoding) on
+// synthetic pixel data.  With --compress 1, requests and replies are
+// compressed with the codings that the benchmark is built with.
+//
+// Usage: ollama_bench [--iterations N] [--latency MS] [--payload BYTES]
+//                     [--dims D] [--inputs N] [--image BYTES] [--compress 0|1]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/ollama.hpp"
+#include "../include/fpng.h"
+#include "../include/pixels.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+struct bench_settings
+{
+  size_t iterations = 50;
+  int latency = 0;          // milliseconds
+  size_t payload = 2048;    // characters of generated text per response
+  size_t dims = 1024;       // embedding dimensions
+  size_t inputs = 64;       // embedding inputs per request
+  size_t image = 256 << 10; // bytes of image data per chat image
+  bool compress = false;    // compressed requests and replies
+};
+
+// Print the throughput and the median and 99th percentile latency of a series
+// of timed operations
+static void
+report (const string& name, vector<double> times, double bytes = 0)
+{
+  double total = 0;
+  for (double t : times)
+  {
+    total += t;
+  }
+  sort (times.begin (), times.end ());
+  size_t n = times.size ();
+  double p50 = times[n / 2];
+  double p99 = times[min (n - 1, size_t (n * 0.99))];
+  printf ("%-28s %8.1f ops/s  p50 %9.3f ms  p99 %9.3f ms", name.c_str (),
+          n / total, p50 * 1e3, p99 * 1e3);
+  if (bytes > 0)
+  {
+    printf ("  %8.1f MB/s", bytes * n / total / 1e6);
+  }
+  printf ("\n");
+}
+
+// Time n runs of an operation
+static vector<double>
+measure (size_t n, const function<void (size_t)>& operation)
+{
+  vector<double> times (n);
+  for (size_t i = 0; i < n; i++)
+  {
+    auto start = chrono::steady_clock::now ();
+    operation (i);
+    times[i] = chrono::duration<double> (chrono::steady_clock::now ()
+                                         - start).count ();
+  }
+  return times;
+}
+
+// Mock responses in the format of the ollama server
+static string
+generate_reply (const bench_settings& cfg)
+{
+  json reply = {{"model", "bench"}, {"created_at", "2026-01-01T00:00:00Z"},
+                {"response", string (cfg.payload, 'x')}, {"done", true},
+                {"done_reason", "stop"}, {"total_duration", 1000000},
+                {"load_duration", 1000}, {"prompt_eval_count", 10},
+                {"prompt_eval_duration", 1000}, {"eval_count", 100},
+                {"eval_duration", 100000}};
+  return reply.dump ();
+}
+
+static string
+chat_reply (const bench_settings& cfg)
+{
+  json reply = {{"model", "bench"}, {"created_at", "2026-01-01T00:00:00Z"},
+                {"message", {{"role", "assistant"},
+                             {"content", string (cfg.payload, 'x')}}},
+                {"done", true}, {"done_reason", "stop"},
+                {"total_duration", 1000000}, {"eval_count", 100}};
+  return reply.dump ();
+}
+
+static string
+embed_reply (const bench_settings& cfg)
+{
+  mt19937 rng (1);
+  normal_distribution<double> dist;
+  json embeddings = json::array ();
+  for (size_t i = 0; i < cfg.inputs; i++)
+  {
+    json vec = json::array ();
+    for (size_t d = 0; d < cfg.dims; d++)
+    {
+      vec.push_back (dist (rng));
+    }
+    embeddings.push_back (std::move (vec));
+  }
+  json reply = {{"model", "bench"}, {"embeddings", embeddings},
+                {"total_duration", 1000000}, {"prompt_eval_count", 100}};
+  return reply.dump ();
+}
+
+// Compress a mock response once, so that the benchmark measures the
+// decompression by the client but not the compression by the mock server
+static string
+gzip (const string& body)
+{
+  string compressed;
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+  httplib::detail::gzip_compressor compressor;
+  compressor.compress (body.data (), body.size (), true,
+                       [&compressed] (const char *data, size_t length)
+  {
+    compressed.append (data, length);
+    return true;
+  });
+#endif
+  return compressed;
+}
+
+static void
+bench_generate (Ollama& client, const bench_settings& cfg)
+{
+  string prompt (200, 'p');
+  report ("generate", measure (cfg.iterations, [&] (size_t)
+  {
+    ollama::request request ("bench", prompt, "false", "");
+    ollama::response response = client.generate (request);
+    if (response.as_simple_string ().size () != cfg.payload)
+    {
+      throw runtime_error ("unexpected generate response");
+    }
+  }));
+}
+
+static void
+bench_chat (Ollama& client, const bench_settings& cfg, bool with_image)
+{
+  vector<unsigned char> data (cfg.image);
+  mt19937 rng (2);
+  for (auto& b : data)
+  {
+    b = rng ();
+  }
+  ollama::image image (macaron::Base64::Encode (string (data.begin (),
+                                                        data.end ())));
+  ollama::messages history;
+  string content (200, 'c');
+  report (with_image ? "chat (growing, image)" : "chat (growing history)",
+          measure (cfg.iterations, [&] (size_t i)
+  {
+    if (with_image && i == 0)
+    {
+      history.push_back (ollama::message ("user", content,
+                                          vector<ollama::image> {image}));
+    }
+    else
+    {
+      history.push_back (ollama::message ("user", content));
+    }
+    ollama::request request ("bench", history, "false", "", "NA");
+    ollama::response response = client.chat (request);
+    history.push_back (ollama::message ("assistant",
+                                        response.as_simple_string ()));
+  }));
+}
+
+static void
+bench_embed (Ollama& client, const bench_settings& cfg)
+{
+  vector<string> input (cfg.inputs, string (100, 'e'));
+  report ("embed", measure (cfg.iterations, [&] (size_t)
+  {
+    ollama::request request = ollama::request::from_embedding ("bench",
+                                                               input);
+    ollama::response response = client.generate_embeddings (request);
+    // Convert the vectors the same way as __ollama__ does
+    const json& emb = response.as_json ()["embeddings"];
+    vector<double> matrix (cfg.inputs * cfg.dims);
+    for (size_t r = 0; r < emb.size (); r++)
+    {
+      for (size_t c = 0; c < emb[r].size (); c++)
+      {
+        matrix[c * cfg.inputs + r] = emb[r][c].get<double> ();
+      }
+    }
+  }), double (cfg.inputs * cfg.dims * sizeof (double)));
+}
+
+static void
+bench_figures (const bench_settings& cfg)
+{
+  fpng::fpng_init ();
+  const size_t sizes[][2] = {{480, 640}, {720, 1280}, {1080, 1920},
+                             {2160, 3840}};
+  for (const auto& size : sizes)
+  {
+    size_t rows = size[0];
+    size_t cols = size[1];
+    // Column-major planes of a plot-like image: mostly flat with some lines
+    vector<unsigned char> planes (rows * cols * 3, 255);
+    for (size_t i = 0; i < planes.size (); i += 97)
+    {
+      planes[i] = (i / 97) % 256;
+    }
+    vector<unsigned char> pixels (rows * cols * 3);
+    vector<uint8_t> png;
+    string name = "fig2base64 " + to_string (cols) + "x" + to_string (rows);
+    size_t n = max<size_t> (3, cfg.iterations * 640 * 480 / (rows * cols));
+    report (name, measure (n, [&] (size_t)
+    {
+      interleave_rgb (planes.data (), rows, cols, pixels.data ());
+      fpng::fpng_encode_image_to_memory (pixels.data (), cols, rows, 3, png);
+      string encoded (macaron::Base64::EncodedLength (png.size ()), '\0');
+      macaron::Base64::Encode (png.data (), png.size (), &encoded[0]);
+    }), double (rows * cols * 3));
+  }
+}
+
+int
+main (int argc, char **argv)
+{
+  bench_settings cfg;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    size_t value = strtoull (argv[i+1], nullptr, 10);
+    if (! strcmp (argv[i], "--iterations"))
+    {
+      cfg.iterations = max<size_t> (1, value);
+    }
+    else if (! strcmp (argv[i], "--latency"))
+    {
+      cfg.latency = value;
+    }
+    else if (! strcmp (argv[i], "--payload"))
+    {
+      cfg.payload = value;
+    }
+    else if (! strcmp (argv[i], "--dims"))
+    {
+      cfg.dims = max<size_t> (1, value);
+    }
+    else if (! strcmp (argv[i], "--inputs"))
+    {
+      cfg.inputs = max<size_t> (1, value);
+    }
+    else if (! strcmp (argv[i], "--image"))
+    {
+      cfg.image = value;
+    }
+    else if (! strcmp (argv[i], "--compress"))
+    {
+      cfg.compress = value != 0;
+    }
+    else
+    {
+      fprintf (stderr, "ollama_bench: unknown option '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  // Start the mock server on a free local port
+  string generate = generate_reply (cfg);
+  string chat = chat_reply (cfg);
+  string embed = embed_reply (cfg);
+  httplib::Server server;
+  // Like the ollama server, answer without waiting to coalesce small writes
+  server.set_tcp_nodelay (true);
+  string generate_gz = gzip (generate);
+  string chat_gz = gzip (chat);
+  string embed_gz = gzip (embed);
+  auto reply = [&cfg] (const string& body, const string& body_gz)
+  {
+    return [&cfg, &body, &body_gz] (const httplib::Request& req,
+                                    httplib::Response& res)
+    {
+      if (cfg.latency > 0)
+      {
+        this_thread::sleep_for (chrono::milliseconds (cfg.latency));
+      }
+      if (! body_gz.empty ()
+          && req.get_header_value ("Accept-Encoding").find ("gzip")
+             != string::npos)
+      {
+        res.set_header ("Content-Encoding", "gzip");
+        res.set_content_provider (body_gz.size (), "application/json",
+                                  [&body_gz] (size_t offset, size_t length,
+                                              httplib::DataSink& sink)
+        {
+          return sink.write (body_gz.data () + offset, length);
+        });
+      }
+      else
+      {
+        res.set_content (body, "application/json");
+      }
+    };
+  };
+  server.Post ("/api/generate", reply (generate, generate_gz));
+  server.Post ("/api/chat", reply (chat, chat_gz));
+  server.Post ("/api/embed", reply (embed, embed_gz));
+  int port = server.bind_to_any_port ("127.0.0.1");
+  if (port < 0)
+  {
+    fprintf (stderr, "ollama_bench: could not start the mock server\n");
+    return 1;
+  }
+  thread listener ([&server] () { server.listen_after_bind (); });
+  server.wait_until_ready ();
+
+  printf ("iterations %zu, latency %d ms, payload %zu chars, "
+          "embeddings %zux%zu, image %zu bytes, compression '%s'\n\n",
+          cfg.iterations, cfg.latency, cfg.payload, cfg.inputs, cfg.dims,
+          cfg.image, cfg.compress ? Ollama::accepted_encodings ().c_str ()
+                                  : "none");
+  if (cfg.compress && ! embed_gz.empty ())
+  {
+    printf ("embed reply %zu bytes, %zu bytes gzip compressed\n\n",
+            embed.size (), embed_gz.size ());
+  }
+  int status = 0;
+  try
+  {
+    Ollama client ("http://127.0.0.1:" + to_string (port));
+    client.setCompression (cfg.compress, cfg.compress);
+    bench_generate (client, cfg);
+    bench_chat (client, cfg, false);
+    bench_chat (client, cfg, true);
+    bench_embed (client, cfg);
+    bench_figures (cfg);
+  }
+  catch (const exception& err)
+  {
+    fprintf (stderr, "ollama_bench: %s\n", err.what ());
+    status = 1;
+  }
+  server.stop ();
+  listener.join ();
+  return status;
+}
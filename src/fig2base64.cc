@@ -15,75 +15,262 @@ You should have received a copy of the GNU General Public License along with
 this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <octave/oct.h>
 #include <octave/parse.h>
 
 #include "./include/Base64.h"
 #include "./include/fpng.h"
+#include "./include/downscale.h"
+#include "./include/pixels.h"
 
 using namespace std;
 
+// A figure being encoded.  The pixel data and the PNG buffer are owned by the
+// caller, so that no Octave object is created or released while the figures
+// are encoded in parallel.
+struct figure_png
+{
+  const unsigned char *src;
+  size_t rows;
+  size_t cols;
+  vector<unsigned char> *png;
+  bool ok;
+};
+
+// Repack, downscale and PNG encode a figure.  The scratch buffers are kept per
+// thread and only grow, so that capturing figures in a loop does not allocate
+// them again on every call.
+static void
+encode_png (figure_png& fig, size_t max_size, uint32_t flags)
+{
+  static thread_local vector<unsigned char> pixels;
+  static thread_local vector<unsigned char> scaled;
+  try
+  {
+    pixels.resize (fig.rows * fig.cols * 3);
+    interleave_rgb (fig.src, fig.rows, fig.cols, pixels.data ());
+    const unsigned char *image = pixels.data ();
+    size_t width = fig.cols;
+    size_t height = fig.rows;
+    if (downscale_image (pixels.data (), fig.cols, fig.rows, 3, max_size,
+                         scaled, width, height))
+    {
+      image = scaled.data ();
+    }
+    fig.ok = fpng::fpng_encode_image_to_memory (image, width, height, 3,
+                                                *fig.png, flags);
+  }
+  catch (const std::bad_alloc&)
+  {
+    fig.ok = false;
+  }
+}
+
+// Run task(i) for i = 0 to n-1 on up to one thread per core
+template <typename F>
+static void
+parallel_for (size_t n, F task)
+{
+  size_t workers = min<size_t> (n, max (1u, thread::hardware_concurrency ()));
+  if (workers <= 1)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      task (i);
+    }
+    return;
+  }
+  atomic<size_t> next (0);
+  vector<thread> pool;
+  for (size_t w = 0; w < workers; w++)
+  {
+    pool.emplace_back ([&] ()
+    {
+      for (size_t i = next++; i < n; i = next++)
+      {
+        task (i);
+      }
+    });
+  }
+  for (auto& t : pool)
+  {
+    t.join ();
+  }
+}
+
 DEFMETHOD_DLD (fig2base64, interp, args, nargout,
            "-*- texinfo -*-\n\
- @deftypefn {llms} {@var{base64_string} =} fig2base64 (@var{hfig})\n\
+ @deftypefn  {llms} {@var{base64_string} =} fig2base64 (@var{hfig})\n\
+ @deftypefnx {llms} {@var{base64_string} =} fig2base64 (@dots{}, @qcode{'maxSize'}, @var{maxSize})\n\
+ @deftypefnx {llms} {@var{base64_string} =} fig2base64 (@dots{}, @qcode{'encoder'}, @var{mode})\n\
 \n\
 \n\
 This function returns a PNG-type Base64-encoded string @var{base64_string} \
 from the figure specified by graphics handle @var{hfig}. \n\
 \n\
+If @var{hfig} is an array of figure handles, @var{base64_string} is a cell \
+array of the same size containing the Base64-encoded string of each figure. \
+The pixels of all figures are captured first, and their PNG and Base64 \
+encodings are then computed in parallel. \n\
+\n\
+If @qcode{'maxSize'} is given, the figure is downscaled before PNG encoding so \
+that its longest edge is at most @var{maxSize} pixels, keeping its aspect \
+ratio.  Each output pixel is averaged over the area of the figure it covers. \
+Vision models resize their inputs internally anyway, so a limit matching the \
+model's input resolution reduces the upload size without loss of detail that \
+the model could use.  Figures that already fit are encoded as they are. \n\
+\n\
+@qcode{'encoder'} selects the trade-off between PNG encoding speed and size. \
+@var{mode} can be @qcode{'fast'} (default), @qcode{'small'}, which computes \
+custom Huffman tables for each figure for roughly 6% smaller images at about \
+40% more encoding time, or @qcode{'uncompressed'}, which skips compression \
+altogether. \n\
+\n\
 @end deftypefn")
 {
   // Parse input arguments
-  if (args.length () != 1)
+  if (args.length () < 1 || args.length () % 2 != 1)
   {
     error ("fig2base64: invalig number of input arguments.");
   }
-  // Get image from figure and save it into a uint8NDArray
-  double h = args(0).xdouble_value ("fig2base64: HFIG is not a handle.");
+  size_t max_size = 0;
+  uint32_t flags = 0;
+  for (octave_idx_type p = 1; p < args.length (); p += 2)
+  {
+    string name = args(p).xstring_value ("fig2base64: parameter name must be a character vector.");
+    if (name == "maxSize")
+    {
+      double val = args(p+1).xdouble_value ("fig2base64: 'maxSize' must be a positive integer scalar.");
+      if (val < 1 || val != std::floor (val))
+      {
+        error ("fig2base64: 'maxSize' must be a positive integer scalar.");
+      }
+      max_size = val;
+    }
+    else if (name == "encoder")
+    {
+      string mode = args(p+1).xstring_value ("fig2base64: 'encoder' must be a character vector.");
+      if (mode == "fast")
+      {
+        flags = 0;
+      }
+      else if (mode == "small")
+      {
+        flags = fpng::FPNG_ENCODE_SLOWER;
+      }
+      else if (mode == "uncompressed")
+      {
+        flags = fpng::FPNG_FORCE_UNCOMPRESSED;
+      }
+      else
+      {
+        error ("fig2base64: 'encoder' must be 'fast', 'small', or 'uncompressed'.");
+      }
+    }
+    else
+    {
+      error ("fig2base64: unknown parameter name '%s'.", name.c_str ());
+    }
+  }
+  if (! args(0).isnumeric () || args(0).isempty ())
+  {
+    error ("fig2base64: HFIG is not a handle.");
+  }
+  NDArray handles = args(0).array_value ();
+  octave_idx_type nfig = handles.numel ();
+
+  // Get the images from the figures.  This must be done on this thread.
   octave::gh_manager& gh_mgr = interp.get_gh_manager ();
-  octave::graphics_object go = gh_mgr.get_object (h);
-  if (! go || ! go.isa ("figure"))
+  vector<octave::graphics_object> objects;
+  for (octave_idx_type f = 0; f < nfig; f++)
   {
-    error ("fig2base64: HFIG is not a figure.");
+    octave::graphics_object go = gh_mgr.get_object (handles(f));
+    if (! go || ! go.isa ("figure"))
+    {
+      error ("fig2base64: HFIG is not a figure.");
+    }
+    objects.push_back (go);
   }
   gh_mgr.process_events ();
-  octave_value img = go.get_toolkit ().get_pixels (go);
-  uint8NDArray data = img.uint8_array_value ();
-
-  // Map image from uint8NDArray to unsigned char
-  size_t bytes = data.numel ();
-  size_t rows = data.rows ();
-  size_t cols = data.columns ();
-  uint32_t ch = 3;
-  unsigned char* pixels = new unsigned char[bytes];
-  size_t i = 0;
-  for (octave_idx_type r = 0; r < rows; r++)
-  {
-    for (octave_idx_type c = 0; c < cols; c++)
+  vector<uint8NDArray> data (nfig);
+  vector<figure_png> figs (nfig);
+  // PNG buffers, reused by subsequent calls
+  static vector<vector<unsigned char>> png_buffers;
+  if (png_buffers.size () < size_t (nfig))
+  {
+    png_buffers.resize (nfig);
+  }
+  for (octave_idx_type f = 0; f < nfig; f++)
+  {
+    octave_value img = objects[f].get_toolkit ().get_pixels (objects[f]);
+    data[f] = img.uint8_array_value ();
+    if (data[f].ndims () != 3 || data[f].dim3 () < 3 || data[f].isempty ())
     {
-      pixels[i++] = data(r, c, 0);
-      pixels[i++] = data(r, c, 1);
-      pixels[i++] = data(r, c, 2);
+      error ("fig2base64: unexpected pixel data returned by the toolkit.");
     }
+    figs[f].src = reinterpret_cast<const unsigned char *> (data[f].data ());
+    figs[f].rows = data[f].rows ();
+    figs[f].cols = data[f].columns ();
+    figs[f].png = &png_buffers[f];
+    figs[f].ok = false;
   }
 
-  // Convert image to base64
-  vector<unsigned char> buffer;
-  // Convert image to png
-  fpng::fpng_init();
-  bool ok = fpng::fpng_encode_image_to_memory (pixels, cols, rows, ch, buffer);
-  if (! ok)
+  // Convert images to png
+  static bool fpng_ready = false;
+  if (! fpng_ready)
   {
-    error ("fig2base64: unable to convert image to PNG.");
+    fpng::fpng_init ();
+    fpng_ready = true;
+  }
+  parallel_for (nfig, [&] (size_t f)
+  {
+    encode_png (figs[f], max_size, flags);
+  });
+  for (octave_idx_type f = 0; f < nfig; f++)
+  {
+    if (! figs[f].ok)
+    {
+      error ("fig2base64: unable to convert image to PNG.");
+    }
   }
-  string png_data = string(buffer.begin (), buffer.end ());
-  string base64 = macaron::Base64::Encode (png_data);
 
-  // Clear memory
-  delete [] pixels;
+  // Encode the PNG bytes straight into the returned char arrays, which are
+  // allocated here and only filled by the worker threads
+  vector<charNDArray> base64 (nfig);
+  vector<char *> out (nfig);
+  for (octave_idx_type f = 0; f < nfig; f++)
+  {
+    size_t len = macaron::Base64::EncodedLength (figs[f].png->size ());
+    base64[f] = charNDArray (dim_vector (1, len));
+    out[f] = base64[f].fortran_vec ();
+  }
+  parallel_for (nfig, [&] (size_t f)
+  {
+    macaron::Base64::Encode (figs[f].png->data (), figs[f].png->size (),
+                             out[f]);
+  });
 
-  // Return string_base64 encoded image
+  // Return string_base64 encoded image(s)
   octave_value_list retval (nargout);
-  retval(0) = base64;
+  if (nfig == 1)
+  {
+    retval(0) = octave_value (base64[0], '\'');
+  }
+  else
+  {
+    Cell strings (handles.dims ());
+    for (octave_idx_type f = 0; f < nfig; f++)
+    {
+      strings(f) = octave_value (base64[f], '\'');
+    }
+    retval(0) = strings;
+  }
   return retval;
 }
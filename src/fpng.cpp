@@ -1682,7 +1682,9 @@ do_literals:
 		int i, bpl = w * num_chans;
 		uint32_t y;
 
-		std::vector<uint8_t> temp_buf;
+		// The filtered scanlines are kept per thread, so that repeated encodes reuse the buffer once it has
+		// grown to the largest image size.
+		static thread_local std::vector<uint8_t> temp_buf;
 		temp_buf.resize((bpl + 1) * h + 7);
 		uint32_t temp_buf_ofs = 0;
 
@@ -25,14 +25,330 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
+// Vectorized kernels are used for the bulk of the data whenever the CPU
+// supports them; the scalar code below handles the tail and serves as the
+// fallback.  Define MACARON_BASE64_NO_SIMD to build the scalar code only.
+#if !defined(MACARON_BASE64_NO_SIMD) &&                                        \
+    (defined(__GNUC__) || defined(__clang__))
+#if defined(__x86_64__) || defined(__i386__)
+#define MACARON_BASE64_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define MACARON_BASE64_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
 namespace macaron {
 
+namespace detail {
+
+// Each kernel consumes whole blocks only and returns the number of input
+// bytes it has processed; the caller resumes with the scalar loop from there.
+
+#if defined(MACARON_BASE64_X86)
+
+__attribute__((target("ssse3"))) inline __m128i
+EncodeLookup128(__m128i indices) {
+  // Map the 6-bit indices to ASCII by adding a per-range offset selected
+  // through pshufb: 0..25 -> 'A', 26..51 -> 'a', 52..61 -> '0', 62 '+', 63 '/'.
+  const __m128i shift_lut = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), indices);
+}
+
+__attribute__((target("ssse3"))) inline __m128i
+EncodeSplit128(__m128i in) {
+  // Spread 12 input bytes over 16 lanes, each holding one 6-bit index.
+  in = _mm_shuffle_epi8(
+      in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3"))) inline size_t
+EncodeSSSE3(const unsigned char *src, size_t len, char *dst) {
+  size_t i = 0;
+  // Each iteration loads 16 bytes but consumes 12 of them.
+  for (; i + 16 <= len; i += 12, dst += 16) {
+    const __m128i in =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                     EncodeLookup128(EncodeSplit128(in)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) inline size_t
+EncodeAVX2(const unsigned char *src, size_t len, char *dst) {
+  const __m256i split = _mm256_setr_epi8(
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m256i shift_lut = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+  // Each iteration consumes 24 bytes, 12 per 128-bit lane.
+  for (; i + 28 <= len; i += 24, dst += 32) {
+    const __m128i lo =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    const __m128i hi =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 12));
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    in = _mm256_shuffle_epi8(in, split);
+    const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const __m256i indices = _mm256_or_si256(t1, t3);
+    __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    result =
+        _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    result = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, result), indices);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), result);
+  }
+  return i + EncodeSSSE3(src + i, len - i, dst);
+}
+
+// Translate 16 ASCII characters to their 6-bit values.  Returns false if any
+// of them is outside the base64 alphabet.
+__attribute__((target("ssse3"))) inline bool
+DecodeLookup128(__m128i &str) {
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+                                       0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                       0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                       0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0,
+                                         0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+  const __m128i hi_nibbles =
+      _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+  const __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+  const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+  const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+  const __m128i ok =
+      _mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128());
+  if (_mm_movemask_epi8(ok) != 0xFFFF)
+    return false;
+  const __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+  const __m128i roll =
+      _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+  str = _mm_add_epi8(str, roll);
+  return true;
+}
+
+__attribute__((target("ssse3"))) inline size_t
+DecodeSSSE3(const char *src, size_t len, unsigned char *dst) {
+  size_t i = 0;
+  // Each iteration stores 16 bytes, of which 12 are valid; keeping 8 input
+  // characters in reserve guarantees room for the 4 spare bytes and leaves
+  // any '=' padding to the scalar loop.
+  for (; i + 24 <= len; i += 16, dst += 12) {
+    __m128i str = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    if (!DecodeLookup128(str))
+      break;
+    const __m128i ab_bc = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+    const __m128i abc = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+    const __m128i out = _mm_shuffle_epi8(
+        abc, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1,
+                           -1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), out);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) inline size_t
+DecodeAVX2(const char *src, size_t len, unsigned char *dst) {
+  const __m256i lut_lo = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+      0x1B, 0x1B, 0x1B, 0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+  const __m256i pack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  // Each iteration stores 32 bytes, of which 24 are valid.
+  for (; i + 48 <= len; i += 32, dst += 24) {
+    __m256i str =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    const __m256i hi_nibbles =
+        _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+    const __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+    const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm256_testz_si256(lo, hi))
+      break;
+    const __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+    const __m256i roll =
+        _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+    str = _mm256_add_epi8(str, roll);
+    const __m256i ab_bc =
+        _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+    __m256i out = _mm256_madd_epi16(ab_bc, _mm256_set1_epi32(0x00011000));
+    out = _mm256_shuffle_epi8(out, pack);
+    out = _mm256_permutevar8x32_epi32(
+        out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), out);
+  }
+  return i + DecodeSSSE3(src + i, len - i, dst);
+}
+
+inline size_t EncodeNone(const unsigned char *, size_t, char *) { return 0; }
+inline size_t DecodeNone(const char *, size_t, unsigned char *) { return 0; }
+
+typedef size_t (*EncodeKernel)(const unsigned char *, size_t, char *);
+typedef size_t (*DecodeKernel)(const char *, size_t, unsigned char *);
+
+inline EncodeKernel SelectEncoder() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return EncodeAVX2;
+  if (__builtin_cpu_supports("ssse3"))
+    return EncodeSSSE3;
+  return EncodeNone;
+}
+
+inline DecodeKernel SelectDecoder() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return DecodeAVX2;
+  if (__builtin_cpu_supports("ssse3"))
+    return DecodeSSSE3;
+  return DecodeNone;
+}
+
+inline size_t EncodeBlocks(const unsigned char *src, size_t len, char *dst) {
+  static const EncodeKernel kernel = SelectEncoder();
+  return kernel(src, len, dst);
+}
+
+inline size_t DecodeBlocks(const char *src, size_t len, unsigned char *dst) {
+  static const DecodeKernel kernel = SelectDecoder();
+  return kernel(src, len, dst);
+}
+
+#elif defined(MACARON_BASE64_NEON)
+
+inline size_t EncodeBlocks(const unsigned char *src, size_t len, char *dst) {
+  static constexpr unsigned char kTable[64] = {
+      'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+      'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+      'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+      'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+      '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'};
+  const uint8x16x4_t table = vld1q_u8_x4(kTable);
+  const uint8x16_t mask = vdupq_n_u8(0x3F);
+  size_t i = 0;
+  // Each iteration consumes 48 bytes and emits 64 characters.
+  for (; i + 48 <= len; i += 48, dst += 64) {
+    const uint8x16x3_t in = vld3q_u8(src + i);
+    uint8x16x4_t out;
+    out.val[0] = vshrq_n_u8(in.val[0], 2);
+    out.val[1] = vandq_u8(
+        vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+    out.val[2] = vandq_u8(
+        vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+    out.val[3] = vandq_u8(in.val[2], mask);
+    out.val[0] = vqtbl4q_u8(table, out.val[0]);
+    out.val[1] = vqtbl4q_u8(table, out.val[1]);
+    out.val[2] = vqtbl4q_u8(table, out.val[2]);
+    out.val[3] = vqtbl4q_u8(table, out.val[3]);
+    vst4q_u8(reinterpret_cast<unsigned char *>(dst), out);
+  }
+  return i;
+}
+
+inline size_t DecodeBlocks(const char *src, size_t len, unsigned char *dst) {
+  // 0xFF marks characters outside the alphabet; bytes >= 0x80 are rejected
+  // by checking their top bit.
+  static constexpr unsigned char kTable[128] = {
+      255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+      255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+      255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+      255, 255, 255, 255, 62,  255, 255, 255, 63,  52,  53,  54,  55,
+      56,  57,  58,  59,  60,  61,  255, 255, 255, 255, 255, 255, 255,
+      0,   1,   2,   3,   4,   5,   6,   7,   8,   9,   10,  11,  12,
+      13,  14,  15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25,
+      255, 255, 255, 255, 255, 255, 26,  27,  28,  29,  30,  31,  32,
+      33,  34,  35,  36,  37,  38,  39,  40,  41,  42,  43,  44,  45,
+      46,  47,  48,  49,  50,  51,  255, 255, 255, 255, 255};
+  const uint8x16x4_t lo = vld1q_u8_x4(kTable);
+  const uint8x16x4_t hi = vld1q_u8_x4(kTable + 64);
+  const uint8x16_t flip = vdupq_n_u8(0x40);
+  size_t i = 0;
+  // Each iteration consumes 64 characters; the last 4 are always left to the
+  // scalar loop so that '=' padding never reaches the vector code.
+  for (; i + 68 <= len; i += 64, dst += 48) {
+    uint8x16x4_t str =
+        vld4q_u8(reinterpret_cast<const unsigned char *>(src + i));
+    uint8x16_t err = vdupq_n_u8(0);
+    for (int k = 0; k < 4; k++) {
+      const uint8x16_t c = str.val[k];
+      const uint8x16_t v = vorrq_u8(vqtbl4q_u8(lo, c),
+                                    vqtbl4q_u8(hi, veorq_u8(c, flip)));
+      err = vorrq_u8(err, vorrq_u8(v, c));
+      str.val[k] = v;
+    }
+    if (vmaxvq_u8(err) & 0x80)
+      break;
+    uint8x16x3_t out;
+    out.val[0] =
+        vorrq_u8(vshlq_n_u8(str.val[0], 2), vshrq_n_u8(str.val[1], 4));
+    out.val[1] =
+        vorrq_u8(vshlq_n_u8(str.val[1], 4), vshrq_n_u8(str.val[2], 2));
+    out.val[2] = vorrq_u8(vshlq_n_u8(str.val[2], 6), str.val[3]);
+    vst3q_u8(dst, out);
+  }
+  return i;
+}
+
+#else
+
+inline size_t EncodeBlocks(const unsigned char *, size_t, char *) {
+  return 0;
+}
+
+inline size_t DecodeBlocks(const char *, size_t, unsigned char *) {
+  return 0;
+}
+
+#endif
+
+} // namespace detail
+
 class Base64 {
 public:
-  static std::string Encode(const std::string &data) {
+  static constexpr size_t EncodedLength(size_t in_len) {
+    return 4 * ((in_len + 2) / 3);
+  }
+
+  // Encode in_len bytes from data into out, which must have room for
+  // EncodedLength(in_len) characters.  No terminator is written.
+  static void Encode(const unsigned char *data, size_t in_len, char *out) {
     static constexpr char sEncodingTable[] = {
         'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
         'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
@@ -40,13 +356,10 @@ public:
         'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
         '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'};
 
-    size_t in_len = data.size();
-    size_t out_len = 4 * ((in_len + 2) / 3);
-    std::string ret(out_len, '\0');
-    size_t i;
-    char *p = const_cast<char *>(ret.c_str());
+    size_t i = detail::EncodeBlocks(data, in_len, out);
+    char *p = out + i / 3 * 4;
 
-    for (i = 0; in_len > 2 && i < in_len - 2; i += 3) {
+    for (; in_len > 2 && i < in_len - 2; i += 3) {
       *p++ = sEncodingTable[(data[i] >> 2) & 0x3F];
       *p++ = sEncodingTable[((data[i] & 0x3) << 4) |
                             ((int)(data[i + 1] & 0xF0) >> 4)];
@@ -66,11 +379,20 @@ public:
       }
       *p++ = '=';
     }
+  }
 
+  static std::string Encode(const std::string &data) {
+    std::string ret(EncodedLength(data.size()), '\0');
+    Encode(reinterpret_cast<const unsigned char *>(data.data()), data.size(),
+           &ret[0]);
     return ret;
   }
 
-  static std::string Decode(const std::string &input, std::string &out) {
+  // Decode input into out, which may be a std::string or a byte container
+  // such as std::vector<unsigned char>.  An error message is returned on
+  // failure and an empty string on success.
+  template <typename Buffer>
+  static std::string Decode(const std::string &input, Buffer &out) {
     static constexpr unsigned char kDecodingTable[] = {
         64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
         64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
@@ -99,20 +421,26 @@ public:
       out_len--;
 
     out.resize(out_len);
+    if (out_len == 0)
+      return "";
+
+    size_t i = detail::DecodeBlocks(
+        input.data(), in_len, reinterpret_cast<unsigned char *>(&out[0]));
+    size_t j = i / 4 * 3;
 
-    for (size_t i = 0, j = 0; i < in_len;) {
+    for (; i < in_len;) {
       uint32_t a = input[i] == '='
                        ? 0 & i++
-                       : kDecodingTable[static_cast<int>(input[i++])];
+                       : kDecodingTable[static_cast<unsigned char>(input[i++])];
       uint32_t b = input[i] == '='
                        ? 0 & i++
-                       : kDecodingTable[static_cast<int>(input[i++])];
+                       : kDecodingTable[static_cast<unsigned char>(input[i++])];
       uint32_t c = input[i] == '='
                        ? 0 & i++
-                       : kDecodingTable[static_cast<int>(input[i++])];
+                       : kDecodingTable[static_cast<unsigned char>(input[i++])];
       uint32_t d = input[i] == '='
                        ? 0 & i++
-                       : kDecodingTable[static_cast<int>(input[i++])];
+                       : kDecodingTable[static_cast<unsigned char>(input[i++])];
 
       uint32_t triple =
           (a << 3 * 6) + (b << 2 * 6) + (c << 1 * 6) + (d << 0 * 6);
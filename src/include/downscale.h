@@ -0,0 +1,140 @@
+/*
+Copyright (C) 2025-2026 Andreas Bertsatos <abertsatos@biol.uoa.gr>
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LLMS_DOWNSCALE_H
+#define LLMS_DOWNSCALE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Source pixels covering one output pixel along an axis, with the fraction of
+// the output pixel that each of them covers.
+struct downscale_span
+{
+  size_t first;
+  size_t count;
+  size_t weight;
+};
+
+// Compute the spans of a box filter reducing n source pixels to m output
+// pixels.  The weights of all spans are stored contiguously in weights.
+static inline void
+downscale_spans (size_t n, size_t m, std::vector<downscale_span>& spans,
+                 std::vector<float>& weights)
+{
+  double scale = double (n) / double (m);
+  spans.resize (m);
+  weights.clear ();
+  for (size_t o = 0; o < m; o++)
+  {
+    double x0 = o * scale;
+    double x1 = std::min (double (n), (o + 1) * scale);
+    size_t first = size_t (x0);
+    size_t last = std::min (n, size_t (std::ceil (x1)));
+    spans[o].first = first;
+    spans[o].count = last - first;
+    spans[o].weight = weights.size ();
+    for (size_t i = first; i < last; i++)
+    {
+      double cover = std::min (x1, double (i + 1)) - std::max (x0, double (i));
+      weights.push_back (float (cover / scale));
+    }
+  }
+}
+
+// Downscale the interleaved 8-bit image src of width x height pixels with the
+// given number of channels so that its longest edge is at most max_edge
+// pixels, averaging each output pixel over the source area that it covers.
+// The image, which is written to dst, keeps its aspect ratio.  Nothing is done
+// and false is returned if the image already fits.
+static inline bool
+downscale_image (const unsigned char *src, size_t width, size_t height,
+                 size_t channels, size_t max_edge,
+                 std::vector<unsigned char>& dst, size_t& out_width,
+                 size_t& out_height)
+{
+  size_t edge = std::max (width, height);
+  if (max_edge == 0 || edge <= max_edge)
+  {
+    return false;
+  }
+  double scale = double (max_edge) / double (edge);
+  out_width = std::max (size_t (1), size_t (std::lround (width * scale)));
+  out_height = std::max (size_t (1), size_t (std::lround (height * scale)));
+  out_width = std::min (out_width, max_edge);
+  out_height = std::min (out_height, max_edge);
+
+  std::vector<downscale_span> xspans, yspans;
+  std::vector<float> xweights, yweights;
+  downscale_spans (width, out_width, xspans, xweights);
+  downscale_spans (height, out_height, yspans, yweights);
+
+  // Horizontal pass into a float image of height x out_width pixels
+  size_t row = out_width * channels;
+  std::vector<float> tmp (height * row);
+  for (size_t y = 0; y < height; y++)
+  {
+    const unsigned char *in = src + y * width * channels;
+    float *out = tmp.data () + y * row;
+    for (size_t x = 0; x < out_width; x++)
+    {
+      const downscale_span& s = xspans[x];
+      const float *w = xweights.data () + s.weight;
+      for (size_t k = 0; k < channels; k++)
+      {
+        const unsigned char *p = in + s.first * channels + k;
+        float sum = 0;
+        for (size_t i = 0; i < s.count; i++)
+        {
+          sum += w[i] * p[i * channels];
+        }
+        out[x * channels + k] = sum;
+      }
+    }
+  }
+
+  // Vertical pass, accumulating whole rows so that the inner loop runs over
+  // contiguous memory
+  dst.resize (out_height * row);
+  std::vector<float> acc (row);
+  for (size_t y = 0; y < out_height; y++)
+  {
+    const downscale_span& s = yspans[y];
+    const float *w = yweights.data () + s.weight;
+    std::fill (acc.begin (), acc.end (), 0.0f);
+    for (size_t i = 0; i < s.count; i++)
+    {
+      const float *in = tmp.data () + (s.first + i) * row;
+      float wi = w[i];
+      for (size_t j = 0; j < row; j++)
+      {
+        acc[j] += wi * in[j];
+      }
+    }
+    unsigned char *out = dst.data () + y * row;
+    for (size_t j = 0; j < row; j++)
+    {
+      float v = acc[j] + 0.5f;
+      out[j] = (unsigned char) (v < 0 ? 0 : (v > 255 ? 255 : v));
+    }
+  }
+  return true;
+}
+
+#endif
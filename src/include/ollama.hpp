@@ -70,6 +70,9 @@
 #include "Base64.h"
 
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <fstream>
 #include <iostream>
@@ -77,6 +80,7 @@
 #include <functional>
 #include <exception>
 #include <initializer_list>
+#include <chrono>
 
 // Namespace types and classes
 namespace ollama
@@ -92,6 +96,22 @@ namespace ollama
     inline void show_requests(bool enable) {log_requests = enable;}
     inline void show_replies(bool enable) {log_replies = enable;}
 
+    // How long the server keeps a model loaded after a request, either as a duration string such as "5m"
+    // or as a number of seconds, where a negative number keeps the model loaded indefinitely.
+    static json model_keep_alive = "5m";
+    inline void set_model_keep_alive(const json& duration) {model_keep_alive = duration;}
+
+    // Timestamps of the phases of the last POST request sent from the current thread: the request
+    // start, the first write of its body (once the connection is established), the end of the body,
+    // the arrival of the response headers, and the end of the response body.  Phases that were not
+    // reached keep a default (zero) time point.
+    struct request_timing
+    {
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start, connected, sent, headers, done;
+    };
+    static thread_local request_timing last_request_timing;
+
     enum class message_type { generation, chat, embedding };
 
     class exception : public std::exception {
@@ -107,24 +127,48 @@ namespace ollama
 
     class image {
         public:
-            image(const std::string base64_sequence, bool valid = true)
+            image(std::string base64_sequence, bool valid = true)
             {
-                this->base64_sequence = base64_sequence; this->valid = valid;
+                this->base64_sequence = std::move(base64_sequence); this->valid = valid;
             }
-            ~image(){};
 
+            // The file size is taken up front so that the encoded sequence is allocated once; the file is
+            // then read in large blocks and each block is encoded straight into it, so the raw file contents
+            // are never held in memory as a whole.
             static image from_file(const std::string& filepath)
             {
                 bool valid = true;
-                std::ifstream file(filepath, std::ios::binary);
+                std::ifstream file(filepath, std::ios::binary | std::ios::ate);
                 if (!file) {
                     if (ollama::use_exceptions) throw ollama::exception("Unable to open image file from path.");
                     valid = false; return image("", valid);
                 }
 
-                std::string file_contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                std::streamoff size = file.tellg();
+                if (size < 0 || !file.seekg(0)) {
+                    if (ollama::use_exceptions) throw ollama::exception("Unable to read image file from path.");
+                    valid = false; return image("", valid);
+                }
+
+                const size_t block_size = 3 << 20;   // a multiple of 3, so only the last block is padded
+                size_t remaining = static_cast<size_t>(size);
+                std::string encoded(macaron::Base64::EncodedLength(remaining), '\0');
+                std::vector<unsigned char> block(std::min(remaining, block_size));
+                char* out = &encoded[0];
+
+                while (remaining > 0)
+                {
+                    size_t n = std::min(remaining, block_size);
+                    if (!file.read(reinterpret_cast<char*>(block.data()), n)) {
+                        if (ollama::use_exceptions) throw ollama::exception("Unable to read image file from path.");
+                        valid = false; return image("", valid);
+                    }
+                    macaron::Base64::Encode(block.data(), n, out);
+                    out += macaron::Base64::EncodedLength(n);
+                    remaining -= n;
+                }
 
-                return image(macaron::Base64::Encode(file_contents), valid);
+                return image(std::move(encoded), valid);
             }
 
             static image from_base64_string(const std::string& base64_string)
@@ -139,7 +183,8 @@ namespace ollama
 
             bool is_valid(){return valid;}
 
-            operator std::string() const { return base64_sequence; }
+            operator std::string() const & { return base64_sequence; }
+            operator std::string() && { return std::move(base64_sequence); }
 
             operator std::vector<ollama::image>() const { std::vector<ollama::image> images; images.push_back(*this); return images; }
             operator std::vector<std::string>() const { std::vector<std::string> images; images.push_back(*this); return images; }
@@ -161,7 +206,6 @@ namespace ollama
                     this->push_back(value);
                 }
             }
-            ~images(){};
             std::vector<std::string> to_strings()
             {
                 std::vector<std::string> strings;
@@ -227,7 +271,6 @@ namespace ollama
                     this->push_back(value);
                 }
             }
-            ~messages(){};
             const std::vector<std::string> to_strings() const
             {
                 std::vector<std::string> strings;
@@ -250,6 +293,14 @@ namespace ollama
 
     };
 
+    // Wrap an already serialized JSON text, such as the encoded tools of a chat request, so that it is
+    // written verbatim into the request body by json_writer instead of being parsed and dumped again.
+    // The fragment is held as a binary value, so dump() does not produce valid JSON for it.
+    inline json json_fragment(const std::string& text)
+    {
+        return json::binary(json::binary_t::container_type(text.begin(), text.end()));
+    }
+
     class request: public json {
 
     public:
@@ -258,7 +309,7 @@ namespace ollama
             // Thinking is parsed as a string to support GPT-OSS which accepts "low", "medium", or "high".
             // Standard "true"/"false" values are converted to boolean values internally
             // A generation request may contain options and images
-            request(const std::string& model, const std::string& prompt, const std::string& think, const std::string& sysmsg, const json& options=nullptr, const std::vector<std::string>& images=std::vector<std::string>()): request()
+            request(const std::string& model, const std::string& prompt, const std::string& think, const std::string& sysmsg, const json& options=nullptr, const std::vector<std::string>& images=std::vector<std::string>(), const json& keep_alive_duration=ollama::model_keep_alive): request()
             {
                 (*this)["model"] = model;
                 (*this)["prompt"] = prompt;
@@ -271,6 +322,7 @@ namespace ollama
                 if (!sysmsg.empty()) (*this)["system"] = sysmsg;
                 if (options!=nullptr) (*this)["options"] = options["options"];
                 if (!images.empty()) (*this)["images"] = images;
+                (*this)["keep_alive"] = keep_alive_duration;
 
                 type = message_type::generation;
             }
@@ -279,7 +331,7 @@ namespace ollama
             // Thinking is parsed as a string to support GPT-OSS which accepts "low", "medium", or "high".
             // Standard "true"/"false" values are converted to boolean values internally
             // A chat request may contain options and tools
-            request(const std::string& model, const ollama::messages& messages, const std::string& think, const std::string& sysmsg, const std::string& tools, const json& options=nullptr, const std::string& keep_alive_duration="5m"): request()
+            request(const std::string& model, const ollama::messages& messages, const std::string& think, const std::string& sysmsg, const std::string& tools, const json& options=nullptr, const json& keep_alive_duration=ollama::model_keep_alive): request()
             {
                 (*this)["model"] = model;
                 (*this)["messages"] = messages.to_json();
@@ -290,7 +342,7 @@ namespace ollama
                 else (*this)["think"] = think;
 
                 if (!sysmsg.empty()) (*this)["system"] = sysmsg;
-                if (tools != "NA") (*this)["tools"] = tools;
+                if (tools != "NA") (*this)["tools"] = ollama::json_fragment(tools);
 
                 if (options!=nullptr) (*this)["options"] = options["options"];
                 (*this)["keep_alive"] = keep_alive_duration;
@@ -301,10 +353,9 @@ namespace ollama
             request(message_type type): request() { this->type = type; }
 
             request(): json() {}
-            ~request(){};
 
             // Create a request for generating embeddings with specified dimensions from a vector of strings as an input
-            static ollama::request from_embedding(const std::string& model, const std::vector<std::string>& input, const int& dimensions=0, const json& options=nullptr, bool truncate=true, const std::string& keep_alive_duration="5m")
+            static ollama::request from_embedding(const std::string& model, const std::vector<std::string>& input, const int& dimensions=0, const json& options=nullptr, bool truncate=true, const json& keep_alive_duration=ollama::model_keep_alive)
             {
                 ollama::request request(message_type::embedding);
 
@@ -350,7 +401,6 @@ namespace ollama
             }
 
             response() {json_string = ""; valid = false;}
-            ~response(){};
 
             bool is_valid() const {return valid;};
 
@@ -403,6 +453,101 @@ namespace ollama
         bool valid;
     };
 
+    // Serialize a JSON value in pieces instead of building the whole string, so that a request carrying
+    // large base64 payloads can be written straight to the connection.  The output is identical to dump(),
+    // except for JSON fragments, which are written verbatim.
+    // Long strings that need no escaping, such as encoded images, are passed through from the value itself;
+    // everything else is dumped piecewise into a small buffer.
+    class json_writer {
+        public:
+            typedef std::function<bool(const char*, size_t)> sink;
+
+            json_writer(const sink& out): out(out) {}
+
+            static bool write(const json& value, const sink& out)
+            {
+                json_writer writer(out);
+                return writer.emit(value) && writer.flush();
+            }
+
+            static size_t size(const json& value)
+            {
+                size_t length = 0;
+                write(value, [&length](const char*, size_t n) { length += n; return true; });
+                return length;
+            }
+
+        private:
+            static constexpr size_t buffer_size = 64 * 1024;
+            static constexpr size_t raw_threshold = 4096;
+
+            bool emit(const json& value)
+            {
+                if (value.is_object())
+                {
+                    if (!put("{", 1)) return false;
+                    bool first = true;
+                    for (auto it = value.begin(); it != value.end(); ++it)
+                    {
+                        if (!first && !put(",", 1)) return false;
+                        first = false;
+                        if (!put(json(it.key()).dump()) || !put(":", 1) || !emit(it.value())) return false;
+                    }
+                    return put("}", 1);
+                }
+                if (value.is_array())
+                {
+                    if (!put("[", 1)) return false;
+                    for (size_t i = 0; i < value.size(); i++)
+                        if ((i > 0 && !put(",", 1)) || !emit(value[i])) return false;
+                    return put("]", 1);
+                }
+                if (value.is_binary())
+                {
+                    const json::binary_t& raw = value.get_binary();
+                    return put_raw(reinterpret_cast<const char*>(raw.data()), raw.size());
+                }
+                if (value.is_string())
+                {
+                    const std::string& str = value.get_ref<const std::string&>();
+                    if (str.size() >= raw_threshold && is_plain(str))
+                        return put("\"", 1) && put_raw(str.data(), str.size()) && put("\"", 1);
+                }
+                return put(value.dump());
+            }
+
+            // Printable ASCII other than quote and backslash is written verbatim by dump()
+            static bool is_plain(const std::string& str)
+            {
+                for (unsigned char c: str)
+                    if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\') return false;
+                return true;
+            }
+
+            bool put(const std::string& str) { return put(str.data(), str.size()); }
+
+            bool put(const char* data, size_t length)
+            {
+                if (buffer.size() + length > buffer_size && !flush()) return false;
+                if (length >= buffer_size) return out(data, length);
+                buffer.append(data, length);
+                return true;
+            }
+
+            bool put_raw(const char* data, size_t length) { return flush() && out(data, length); }
+
+            bool flush()
+            {
+                if (buffer.empty()) return true;
+                bool ok = out(buffer.data(), buffer.size());
+                buffer.clear();
+                return ok;
+            }
+
+            const sink& out;
+            std::string buffer;
+    };
+
 }
 
 class Ollama
@@ -413,13 +558,23 @@ class Ollama
 
         Ollama(const std::string& url)
         {
-            this->server_url = url;
-            this->cli = new httplib::Client(url);
-            this->setReadTimeout(120);
+            this->read_timeout = 120;
+            this->setServerURL(url);
         }
 
         Ollama(): Ollama("http://localhost:11434") {}
-        ~Ollama() { delete this->cli; }
+
+        // A copy shares the server settings but opens its own connection,
+        // so that it can be used for requests running on another thread.
+        Ollama(const Ollama& other): Ollama(other.server_url)
+        {
+            this->setConnectionTimeout(other.connection_timeout);
+            this->setReadTimeout(other.read_timeout);
+            this->setWriteTimeout(other.write_timeout);
+            this->setKeepAlive(other.keep_alive);
+            this->setCompression(other.compress_requests, other.compress_responses);
+        }
+        Ollama& operator=(const Ollama&) = delete;
 
     ollama::response generate(const std::string& model,const std::string& prompt, const ollama::response& context, const std::string& think, const std::string& sysmsg, const json& options=nullptr, const std::vector<std::string>& images=std::vector<std::string>())
     {
@@ -440,10 +595,7 @@ class Ollama
         ollama::response response;
 
         request["stream"] = false;
-        std::string request_string = request.dump();
-        if (ollama::log_requests) std::cout << request_string << std::endl;
-
-        if (auto res = this->cli->Post("/api/generate",request_string, "application/json"))
+        if (auto res = post_json("/api/generate", request))
         {
             if (ollama::log_replies) std::cout << res->body << std::endl;
 
@@ -459,7 +611,15 @@ class Ollama
         return response;
     }
 
-    ollama::response chat(const std::string& model, const ollama::messages& messages, const std::string& think, const std::string& sysmsg, const std::string& tools, json options=nullptr, const std::string& keep_alive_duration="5m")
+    // Generate a streaming reply, passing each partial response to a callback.
+    // Streaming is canceled if the callback returns false.
+    ollama::response generate(ollama::request& request, std::function<bool(const ollama::response&)> on_receive_response)
+    {
+        request["stream"] = true;
+        return send_request("/api/generate", request, on_receive_response);
+    }
+
+    ollama::response chat(const std::string& model, const ollama::messages& messages, const std::string& think, const std::string& sysmsg, const std::string& tools, json options=nullptr, const json& keep_alive_duration=ollama::model_keep_alive)
     {
         ollama::request request(model, messages, think, sysmsg, tools, options, keep_alive_duration);
         return chat(request);
@@ -471,10 +631,7 @@ class Ollama
         ollama::response response;
 
         request["stream"] = false;
-        std::string request_string = request.dump();
-        if (ollama::log_requests) std::cout << request_string << std::endl;
-
-        if (auto res = this->cli->Post("/api/chat",request_string, "application/json"))
+        if (auto res = post_json("/api/chat", request))
         {
             if (ollama::log_replies) std::cout << res->body << std::endl;
 
@@ -490,7 +647,15 @@ class Ollama
         return response;
     }
 
-    ollama::response generate_embeddings(const std::string& model, const std::vector<std::string>& input, const int& dimensions=0, const json& options=nullptr, bool truncate = true, const std::string& keep_alive_duration="5m")
+    // Generate a streaming reply, passing each partial response to a callback.
+    // Streaming is canceled if the callback returns false.
+    ollama::response chat(ollama::request& request, std::function<bool(const ollama::response&)> on_receive_response)
+    {
+        request["stream"] = true;
+        return send_request("/api/chat", request, on_receive_response);
+    }
+
+    ollama::response generate_embeddings(const std::string& model, const std::vector<std::string>& input, const int& dimensions=0, const json& options=nullptr, bool truncate = true, const json& keep_alive_duration=ollama::model_keep_alive)
     {
         ollama::request request = ollama::request::from_embedding(model, input, dimensions, options, truncate, keep_alive_duration);
         return generate_embeddings(request);
@@ -501,10 +666,7 @@ class Ollama
     {
         ollama::response response;
 
-        std::string request_string = request.dump();
-        if (ollama::log_requests) std::cout << request_string << std::endl;
-
-        if (auto res = cli->Post("/api/embed", request_string, "application/json"))
+        if (auto res = post_json("/api/embed", request))
         {
             if (ollama::log_replies) std::cout << res->body << std::endl;
 
@@ -566,15 +728,17 @@ class Ollama
 
     }
 
-    bool load_model(const std::string& model, bool load_embeddingModel = false)
+    bool load_model(const std::string& model, bool load_embeddingModel = false, const json& keep_alive_duration = ollama::model_keep_alive)
     {
         json request;
         request["model"] = model;
+        request["keep_alive"] = keep_alive_duration;
         std::string request_string = request.dump();
         if (ollama::log_requests) std::cout << request_string << std::endl;
         if (load_embeddingModel)
         {
             auto res = this->cli->Post("/api/embed", request_string, "application/json");
+            if (!res) return false;
             json response = json::parse(res->body);
             if (ollama::log_replies) std::cout << "Reply from '/api/embed' was " << res->body << std::endl;
             if (response.contains ("embeddings")) {return true;}
@@ -582,6 +746,7 @@ class Ollama
         else
         {
             auto res = this->cli->Post("/api/generate", request_string, "application/json");
+            if (!res) return false;
             json response = json::parse(res->body);
             if (ollama::log_replies) std::cout << "Reply from '/api/generate' was " << res->body << std::endl;
             if (response.contains ("done")) {return response["done"];}
@@ -771,6 +936,69 @@ class Ollama
         return false;
     }
 
+    // Pull a model while streaming its status events.  Each event is passed to the callback as it
+    // arrives, with the digest, total and completed fields while a layer is being downloaded, and the
+    // pull is canceled if the callback returns false.  The server keeps partially downloaded layers,
+    // so that pulling the same model again after a lost connection resumes the download.
+    bool pull_model(const std::string& model, std::function<bool(const json&)> on_progress, bool allow_insecure = false)
+    {
+        json request;
+        request["name"] = model;
+        request["insecure"] = allow_insecure;
+        request["stream"] = true;
+
+        std::string partial_line, error_string;
+        bool success = false;
+        std::exception_ptr callback_exception = nullptr;
+
+        auto on_line = [&](const std::string& line) -> bool
+        {
+            if (line.empty()) return true;
+            if (ollama::log_replies) std::cout << line << std::endl;
+            json event;
+            try { event = json::parse(line); }
+            catch(const json::parse_error&) { throw ollama::exception("Invalid status event returned from ollama when pulling model: "+line.substr(0, 200)); }
+            if (event.contains("error")) { error_string = event["error"].get<std::string>(); return false; }
+            if (event.value("status", "")=="success") success = true;
+            return !on_progress || on_progress(event);
+        };
+        auto on_receive = [&](const char* data, size_t data_length) -> bool
+        {
+            try
+            {
+                partial_line.append(data, data_length);
+                size_t start = 0, end;
+                while ((end = partial_line.find('\n', start)) != std::string::npos)
+                {
+                    if (!on_line(partial_line.substr(start, end - start))) return false;
+                    start = end + 1;
+                }
+                partial_line.erase(0, start);
+                return true;
+            }
+            catch(...) { callback_exception = std::current_exception(); return false; }
+        };
+
+        auto res = post_json("/api/pull", request, on_receive);
+        if (callback_exception) std::rethrow_exception(callback_exception);
+        // An error reply may not end with a newline
+        if (res && error_string.empty() && !partial_line.empty())
+        {
+            try { on_line(partial_line); } catch(...) {}
+        }
+        if (res && res->status==httplib::StatusCode::NotFound_404) { if (ollama::use_exceptions) throw ollama::exception("Model not found when trying to pull (Code 404)."); return false; }
+        if (res && (res->status < 200 || res->status >= 300)) { if (ollama::use_exceptions) throw ollama::exception("Error returned from ollama when pulling model: "+error_reply(*res)); return false; }
+        if (!error_string.empty()) { if (ollama::use_exceptions) throw ollama::exception("Error returned from ollama when pulling model: "+error_string); return false; }
+        if (!res)
+        {
+            if (res.error()==httplib::Error::Canceled) { if (ollama::use_exceptions) throw ollama::exception("Pulling model was canceled."); }
+            else { if (ollama::use_exceptions) throw ollama::exception("No response returned from server when pulling model: "+httplib::to_string( res.error() ) );}
+            return false;
+        }
+        if (!success) { if (ollama::use_exceptions) throw ollama::exception("No response returned from server when pulling model: the status stream ended before the pull completed."); return false; }
+        return true;
+    }
+
     bool push_model(const std::string& model, bool allow_insecure = false)
     {
         json request, response;
@@ -814,35 +1042,288 @@ class Ollama
 
     }
 
+    // Switch to another server.  Clients are cached per URL, so that switching
+    // back to a server that has been used before reuses its open connection.
     void setServerURL(const std::string& server_url)
     {
+        if (this->cli && server_url == this->server_url) return;
         this->server_url = server_url;
-        delete(this->cli);
-        this->cli = new httplib::Client(server_url);
+        auto& client = this->clients[server_url];
+        if (!client)
+        {
+            client.reset(new httplib::Client(server_url));
+            // The request headers and body are written separately, so without this the body waits for
+            // the delayed acknowledgement of the headers (about 40 ms per request)
+            client->set_tcp_nodelay(true);
+        }
+        this->cli = client.get();
+        this->cli->set_connection_timeout(this->connection_timeout);
+        this->cli->set_read_timeout(this->read_timeout);
+        this->cli->set_write_timeout(this->write_timeout);
+        this->cli->set_keep_alive(this->keep_alive);
+    }
+
+    const std::string& getServerURL() const
+    {
+        return this->server_url;
+    }
+
+    // Give up connecting to a server that does not answer after this many seconds.
+    void setConnectionTimeout(const int seconds)
+    {
+        this->connection_timeout = seconds;
+        this->cli->set_connection_timeout(seconds);
     }
 
     void setReadTimeout(const int seconds)
     {
+        this->read_timeout = seconds;
         this->cli->set_read_timeout(seconds);
     }
 
     void setWriteTimeout(const int seconds)
     {
+        this->write_timeout = seconds;
         this->cli->set_write_timeout(seconds);
     }
 
+    // Keep the connection open between requests instead of reconnecting.
+    void setKeepAlive(const bool enable)
+    {
+        this->keep_alive = enable;
+        this->cli->set_keep_alive(enable);
+    }
+
+    // Compress the bodies of large requests with gzip and accept compressed replies, as far as the
+    // client is built with zlib, brotli or zstd support.  The ollama server itself sends uncompressed
+    // replies and does not accept compressed requests, so this is only useful behind a reverse proxy
+    // that does.
+    void setCompression(const bool requests, const bool responses)
+    {
+        this->compress_requests = requests;
+        this->compress_responses = responses;
+    }
+
+    // The content codings that replies can be decompressed from
+    static std::string accepted_encodings()
+    {
+        std::string encodings;
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+        encodings = "br";
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+        if (!encodings.empty()) encodings += ", ";
+        encodings += "gzip, deflate";
+#endif
+#ifdef CPPHTTPLIB_ZSTD_SUPPORT
+        if (!encodings.empty()) encodings += ", ";
+        encodings += "zstd";
+#endif
+        return encodings;
+    }
+
+    // Abort any request in progress.  This may be called from another thread.
+    void stop()
+    {
+        this->cli->stop();
+    }
+
     private:
 
-/*
-    bool send_request(const ollama::request& request, std::function<bool(const ollama::response&)> on_receive_response=nullptr)
+    // POST a JSON request without materializing its body: the length is computed up front and the body
+    // is serialized piece by piece while it is written to the connection.  If a receiver is given, the
+    // reply body is passed to it as it arrives instead of being stored in the response.
+    httplib::Result post_json(const std::string& path, const json& request, httplib::ContentReceiver receiver = nullptr)
     {
+        if (ollama::log_requests)
+        {
+            ollama::json_writer::write(request, [](const char* data, size_t length) { std::cout.write(data, length); return true; });
+            std::cout << std::endl;
+        }
 
-        return true;
+        httplib::Request req;
+        req.method = "POST";
+        req.path = path;
+        req.set_header("Content-Type", "application/json");
+        // httplib only asks for a compressed reply if it is not streamed to a receiver
+        std::string encodings = accepted_encodings();
+        req.set_header("Accept-Encoding", this->compress_responses && !encodings.empty() ? encodings : "identity");
+
+        ollama::request_timing& timing = ollama::last_request_timing;
+        timing = ollama::request_timing();
+        timing.start = ollama::request_timing::clock::now();
+        req.content_length_ = ollama::json_writer::size(request);
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+        // A compressed body is written along with the headers, so that it has no separate send phase
+        if (this->compress_requests && req.content_length_ >= compress_min_size)
+        {
+            httplib::detail::gzip_compressor compressor;
+            auto append = [&req](const char* data, size_t length) { req.body.append(data, length); return true; };
+            bool ok = ollama::json_writer::write(request, [&](const char* data, size_t length)
+            {
+                return compressor.compress(data, length, false, append);
+            });
+            if (ok && compressor.compress(nullptr, 0, true, append))
+            {
+                req.set_header("Content-Encoding", "gzip");
+                req.content_length_ = 0;
+                timing.connected = timing.sent = ollama::request_timing::clock::now();
+            }
+            else req.body.clear();
+        }
+#endif
+        if (req.body.empty()) req.content_provider_ = [&request](size_t offset, size_t, httplib::DataSink& sink)
+        {
+            ollama::request_timing& timing = ollama::last_request_timing;
+            if (timing.connected == ollama::request_timing::clock::time_point()) timing.connected = ollama::request_timing::clock::now();
+            // The whole body is written in one call; a restart at a non-zero offset skips what was sent
+            size_t skip = offset;
+            bool ok = ollama::json_writer::write(request, [&](const char* data, size_t length)
+            {
+                if (skip >= length) { skip -= length; return true; }
+                bool ok = sink.write(data + skip, length - skip);
+                skip = 0;
+                return ok;
+            });
+            timing.sent = ollama::request_timing::clock::now();
+            return ok;
+        };
+        // The body of an error reply, which need not be JSON, is kept in the response instead of being
+        // passed to the receiver
+        int status = 0;
+        std::string error_body;
+        if (receiver) req.content_receiver = [receiver, &status, &error_body](const char* data, size_t length, size_t, size_t)
+        {
+            if (status < 200 || status >= 300) { error_body.append(data, length); return true; }
+            return receiver(data, length);
+        };
+
+        req.response_handler = [&timing, &status](const httplib::Response& response)
+        {
+            timing.headers = ollama::request_timing::clock::now();
+            status = response.status;
+            return true;
+        };
+        auto res = this->cli->send(req);
+        if (res && receiver) res->body = std::move(error_body);
+        timing.done = ollama::request_timing::clock::now();
+        return res;
+    }
+
+    // Describe an error reply by its status and the error message in its body (if any)
+    static std::string error_reply(const httplib::Response& res)
+    {
+        std::string message = res.body.substr(0, 200);
+        try
+        {
+            json body = json::parse(res.body);
+            if (body.contains("error")) message = body["error"].get<std::string>();
+        }
+        catch(...) {}
+        return "Ollama returned status "+std::to_string(res.status)+(message.empty() ? std::string() : ": "+message);
+    }
+
+    // Send a streaming request and parse the NDJSON reply line by line as it
+    // arrives.  Each line is passed to the callback as a partial response and
+    // the text is accumulated, so that the returned response has the same form
+    // as a non-streaming reply with the statistics of the final chunk.
+    ollama::response send_request(const std::string& path, const ollama::request& request, std::function<bool(const ollama::response&)> on_receive_response)
+    {
+        const ollama::message_type type = request.get_type();
+
+        std::string partial_line, content, thinking, error_string;
+        json tool_calls = json::array();
+        json final_chunk;
+        std::exception_ptr callback_exception = nullptr;
+
+        auto on_line = [&](const std::string& line) -> bool
+        {
+            if (line.empty()) return true;
+            if (ollama::log_replies) std::cout << line << std::endl;
+
+            ollama::response partial(line, type);
+            const json& chunk = partial.as_json();
+            if (partial.has_error()) { error_string = partial.get_error(); return false; }
+
+            if (type==ollama::message_type::chat && chunk.contains("message"))
+            {
+                const json& message = chunk["message"];
+                content += message.value("content", "");
+                thinking += message.value("thinking", "");
+                if (message.contains("tool_calls")) for (auto& call: message["tool_calls"]) tool_calls.push_back(call);
+            }
+            else
+            {
+                content += chunk.value("response", "");
+                thinking += chunk.value("thinking", "");
+            }
+            if (chunk.value("done", false)) final_chunk = chunk;
+
+            return !on_receive_response || on_receive_response(partial);
+        };
+        auto on_receive = [&](const char* data, size_t data_length) -> bool
+        {
+            try
+            {
+                partial_line.append(data, data_length);
+                size_t start = 0, end;
+                while ((end = partial_line.find('\n', start)) != std::string::npos)
+                {
+                    if (!on_line(partial_line.substr(start, end - start))) return false;
+                    start = end + 1;
+                }
+                partial_line.erase(0, start);
+                return true;
+            }
+            catch(...) { callback_exception = std::current_exception(); return false; }
+        };
+
+        auto res = post_json(path, request, on_receive);
+        if (callback_exception) std::rethrow_exception(callback_exception);
+        // The last line may not end with a newline
+        if (res && error_string.empty() && final_chunk.is_null() && !partial_line.empty())
+        {
+            on_line(partial_line);
+        }
+        if (res && (res->status < 200 || res->status >= 300)) { if (ollama::use_exceptions) throw ollama::exception(error_reply(*res)); return ollama::response(); }
+        if (!error_string.empty()) { if (ollama::use_exceptions) throw ollama::exception("Ollama response returned error: "+error_string); return ollama::response(); }
+        if (!res)
+        {
+            if (res.error()==httplib::Error::Canceled) { if (ollama::use_exceptions) throw ollama::exception("Streaming reply was canceled."); }
+            else { if (ollama::use_exceptions) throw ollama::exception("No response returned from server "+this->server_url+". Error was: "+httplib::to_string( res.error() )); }
+            return ollama::response();
+        }
+        if (final_chunk.is_null()) { if (ollama::use_exceptions) throw ollama::exception("Incomplete streaming reply returned from server "+this->server_url+"."); return ollama::response(); }
+
+        // Assemble the final response from the accumulated text
+        bool has_thinking = request.contains("think") && request.at("think")!=false;
+        if (type==ollama::message_type::chat)
+        {
+            json message = final_chunk.value("message", json::object());
+            message["content"] = content;
+            if (has_thinking || !thinking.empty()) message["thinking"] = thinking;
+            if (!tool_calls.empty()) message["tool_calls"] = tool_calls;
+            final_chunk["message"] = message;
+        }
+        else
+        {
+            final_chunk["response"] = content;
+            if (has_thinking || !thinking.empty()) final_chunk["thinking"] = thinking;
+        }
+        return ollama::response(final_chunk.dump(), type);
     }
-*/
 
     std::string server_url;
-    httplib::Client *cli;
+    std::map<std::string, std::unique_ptr<httplib::Client>> clients;
+    httplib::Client *cli = nullptr;
+    int connection_timeout = CPPHTTPLIB_CONNECTION_TIMEOUT_SECOND;
+    int read_timeout = CPPHTTPLIB_CLIENT_READ_TIMEOUT_SECOND;
+    int write_timeout = CPPHTTPLIB_CLIENT_WRITE_TIMEOUT_SECOND;
+    bool keep_alive = true;
+    bool compress_requests = false;
+    bool compress_responses = true;
+    // Smaller request bodies are not worth compressing
+    static const size_t compress_min_size = 4096;
 
 };
 
@@ -872,7 +1353,12 @@ namespace ollama
         return ollama.generate(request);
     }
 
-    inline ollama::response chat(const std::string& model, const ollama::messages& messages, const std::string& think, const std::string& sysmsg, const std::string& tools, const json& options=nullptr, const std::string& keep_alive_duration="5m")
+    inline ollama::response generate(ollama::request& request, std::function<bool(const ollama::response&)> on_receive_response)
+    {
+        return ollama.generate(request, on_receive_response);
+    }
+
+    inline ollama::response chat(const std::string& model, const ollama::messages& messages, const std::string& think, const std::string& sysmsg, const std::string& tools, const json& options=nullptr, const json& keep_alive_duration=ollama::model_keep_alive)
     {
         return ollama.chat(model, messages, think, sysmsg, tools, options, keep_alive_duration);
     }
@@ -882,7 +1368,12 @@ namespace ollama
         return ollama.chat(request);
     }
 
-    inline ollama::response generate_embeddings(const std::string& model, const std::vector<std::string>& input, const int& dimensions=0, const json& options=nullptr, bool truncate = true, const std::string& keep_alive_duration="5m")
+    inline ollama::response chat(ollama::request& request, std::function<bool(const ollama::response&)> on_receive_response)
+    {
+        return ollama.chat(request, on_receive_response);
+    }
+
+    inline ollama::response generate_embeddings(const std::string& model, const std::vector<std::string>& input, const int& dimensions=0, const json& options=nullptr, bool truncate = true, const json& keep_alive_duration=ollama::model_keep_alive)
     {
         return ollama.generate_embeddings(model, input, dimensions, options, truncate, keep_alive_duration);
     }
@@ -902,9 +1393,9 @@ namespace ollama
         return ollama.is_running();
     }
 
-    inline bool load_model(const std::string& model, bool load_embeddingModel = false)
+    inline bool load_model(const std::string& model, bool load_embeddingModel = false, const json& keep_alive_duration = ollama::model_keep_alive)
     {
-        return ollama.load_model(model, load_embeddingModel);
+        return ollama.load_model(model, load_embeddingModel, keep_alive_duration);
     }
 
     inline bool unload_model(const std::string& model)
@@ -967,11 +1458,21 @@ namespace ollama
         return ollama.pull_model(model, allow_insecure);
     }
 
+    inline bool pull_model(const std::string& model, std::function<bool(const json&)> on_progress, bool allow_insecure = false)
+    {
+        return ollama.pull_model(model, on_progress, allow_insecure);
+    }
+
     inline bool push_model(const std::string& model, bool allow_insecure = false)
     {
         return ollama.push_model(model, allow_insecure);
     }
 
+    inline const std::string& getServerURL()
+    {
+        return ollama.getServerURL();
+    }
+
     inline void setReadTimeout(const int& seconds)
     {
         ollama.setReadTimeout(seconds);
@@ -982,6 +1483,11 @@ namespace ollama
         ollama.setWriteTimeout(seconds);
     }
 
+    inline void setCompression(const bool requests, const bool responses)
+    {
+        ollama.setCompression(requests, responses);
+    }
+
 }
 
 
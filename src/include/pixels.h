@@ -0,0 +1,57 @@
+/*
+Copyright (C) 2025-2026 Andreas Bertsatos <abertsatos@biol.uoa.gr>
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or (at your option) any later
+version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT
+ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+details.
+
+You should have received a copy of the GNU General Public License along with
+this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LLMS_PIXELS_H
+#define LLMS_PIXELS_H
+
+#include <algorithm>
+#include <cstddef>
+
+// Interleave the column-major R, G, B planes of an image into row-major RGB
+// pixels.  The image is walked in square tiles so that both the strided plane
+// reads and the contiguous pixel writes stay within cache.
+static inline void
+interleave_rgb (const unsigned char *src, size_t rows, size_t cols,
+                unsigned char *pixels)
+{
+  size_t plane = rows * cols;
+  const unsigned char *R = src;
+  const unsigned char *G = src + plane;
+  const unsigned char *B = src + 2 * plane;
+  const size_t tile = 64;
+  for (size_t r0 = 0; r0 < rows; r0 += tile)
+  {
+    size_t r1 = std::min (r0 + tile, rows);
+    for (size_t c0 = 0; c0 < cols; c0 += tile)
+    {
+      size_t c1 = std::min (c0 + tile, cols);
+      for (size_t r = r0; r < r1; r++)
+      {
+        unsigned char *dst = pixels + (r * cols + c0) * 3;
+        for (size_t c = c0; c < c1; c++)
+        {
+          size_t idx = c * rows + r;
+          *dst++ = R[idx];
+          *dst++ = G[idx];
+          *dst++ = B[idx];
+        }
+      }
+    }
+  }
+}
+
+#endif